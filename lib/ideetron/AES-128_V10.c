@@ -148,6 +148,111 @@ void AES_Encrypt(unsigned char *Data, unsigned char *Key)
 
 }
 
+/*
+*****************************************************************************************
+* Description : Function that expands a key into the round keys of all rounds, so that
+*               repeated encryptions with the same key skip the key schedule
+*
+* Arguments   : *Key          Key to expand is a 16 byte long arry
+*               *Round_Keys   AES_ROUND_KEYS_LENGTH byte long array receiving the round keys
+*****************************************************************************************
+*/
+void AES_Expand_Key(unsigned char *Key, unsigned char *Round_Keys)
+{
+	unsigned char i;
+	unsigned char Round;
+
+	//Round key 0 is the key itself
+	for(i = 0; i < 16; i++)
+	{
+		Round_Keys[i] = Key[i];
+	}
+
+	//Calculate each round key from the previous one
+	for(Round = 1; Round < 11; Round++)
+	{
+		for(i = 0; i < 16; i++)
+		{
+			Round_Keys[(16*Round) + i] = Round_Keys[(16*(Round-1)) + i];
+		}
+
+		AES_Calculate_Round_Key(Round,&Round_Keys[16*Round]);
+	}
+}
+
+/*
+*****************************************************************************************
+* Description : Function for encrypting data using AES-128 with expanded round keys
+*
+* Arguments   : *Data         Data to encrypt is a 16 byte long arry
+*               *Round_Keys   Round keys from AES_Expand_Key
+*****************************************************************************************
+*/
+void AES_Encrypt_Expanded(unsigned char *Data, unsigned char *Round_Keys)
+{
+	unsigned char Row,Collum;
+	unsigned char Round = 0x00;
+
+	//Copy input to State arry
+	for(Collum = 0; Collum < 4; Collum++)
+	{
+		for(Row = 0; Row < 4; Row++)
+		{
+			State[Row][Collum] = Data[Row + (4*Collum)];
+		}
+	}
+
+	//Add round key
+	AES_Add_Round_Key(Round_Keys);
+
+	//Preform 9 full rounds
+	for(Round = 1; Round < 10; Round++)
+	{
+		//Preform Byte substitution with S table
+		for(Collum = 0; Collum < 4; Collum++)
+		{
+			for(Row = 0; Row < 4; Row++)
+			{
+				State[Row][Collum] = AES_Sub_Byte(State[Row][Collum]);
+			}
+		}
+
+		//Preform Row Shift
+		AES_Shift_Rows();
+
+		//Mix Collums
+		AES_Mix_Collums();
+
+		//Add round key
+		AES_Add_Round_Key(&Round_Keys[16*Round]);
+	}
+
+	//Last round whitout mix collums
+	//Preform Byte substitution with S table
+	for(Collum = 0; Collum < 4; Collum++)
+	{
+		for(Row = 0; Row < 4; Row++)
+		{
+			State[Row][Collum] = AES_Sub_Byte(State[Row][Collum]);
+		}
+	}
+
+	//Shift rows
+	AES_Shift_Rows();
+
+	//Add round Key
+	AES_Add_Round_Key(&Round_Keys[16*Round]);
+
+	//Copy the State into the data array
+	for(Collum = 0; Collum < 4; Collum++)
+	{
+		for(Row = 0; Row < 4; Row++)
+		{
+			Data[Row + (4*Collum)] = State[Row][Collum];
+		}
+	}
+}
+
 /*
 *****************************************************************************************
 * Description : Function that add's the round key for the current round
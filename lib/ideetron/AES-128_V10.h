@@ -40,7 +40,11 @@
 ********************************************************************************************
 */
 
+#define AES_ROUND_KEYS_LENGTH 176
+
 void AES_Encrypt(unsigned char *Data, unsigned char *Key);
+void AES_Expand_Key(unsigned char *Key, unsigned char *Round_Keys);
+void AES_Encrypt_Expanded(unsigned char *Data, unsigned char *Round_Keys);
 void AES_Add_Round_Key(unsigned char *Round_Key);
 unsigned char AES_Sub_Byte(unsigned char Byte);
 void AES_Shift_Rows();
@@ -28,6 +28,17 @@
 
 void Encrypt_Payload(unsigned char *Data, unsigned char Data_Length, unsigned int Frame_Counter,
                      unsigned char Direction, unsigned char Key[16], unsigned char DevAddr[4])
+{
+	unsigned char Round_Keys[AES_ROUND_KEYS_LENGTH];
+
+	//Expand the key once for all blocks
+	AES_Expand_Key(Key, Round_Keys);
+
+	Encrypt_Payload_Expanded(Data, Data_Length, Frame_Counter, Direction, Round_Keys, DevAddr);
+}
+
+void Encrypt_Payload_Expanded(unsigned char *Data, unsigned char Data_Length, unsigned int Frame_Counter,
+                              unsigned char Direction, unsigned char *Round_Keys, unsigned char DevAddr[4])
 {
 	unsigned char i = 0x00;
 	unsigned char j;
@@ -70,7 +81,7 @@ void Encrypt_Payload(unsigned char *Data, unsigned char Data_Length, unsigned in
 		Block_A[15] = i;
 
 		//Calculate S
-		AES_Encrypt(Block_A, Key);
+		AES_Encrypt_Expanded(Block_A, Round_Keys);
 
 		//Check for last block
 		if(i != Number_of_Blocks)
@@ -99,8 +110,7 @@ void Encrypt_Payload(unsigned char *Data, unsigned char Data_Length, unsigned in
 void Calculate_MIC(unsigned char *Data, unsigned char *Final_MIC, unsigned char Data_Length, unsigned int Frame_Counter,
                    unsigned char Direction, unsigned char NwkSkey[16], unsigned char DevAddr[4])
 {
-	unsigned char i;
-	unsigned char Block_B[16];
+	unsigned char Round_Keys[AES_ROUND_KEYS_LENGTH];
 	unsigned char Key_K1[16] = {
 		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
 		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
@@ -110,6 +120,22 @@ void Calculate_MIC(unsigned char *Data, unsigned char *Final_MIC, unsigned char
 		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
 	};
 
+	//Expand the key once for the subkeys and all blocks
+	AES_Expand_Key(NwkSkey, Round_Keys);
+
+	Generate_Keys_Expanded(Key_K1, Key_K2, Round_Keys);
+
+	Calculate_MIC_Expanded(Data, Final_MIC, Data_Length, Frame_Counter, Direction, Round_Keys, Key_K1, Key_K2,
+	                       DevAddr);
+}
+
+void Calculate_MIC_Expanded(unsigned char *Data, unsigned char *Final_MIC, unsigned char Data_Length,
+                            unsigned int Frame_Counter, unsigned char Direction, unsigned char *Round_Keys,
+                            unsigned char K1[16], unsigned char K2[16], unsigned char DevAddr[4])
+{
+	unsigned char i;
+	unsigned char Block_B[16];
+
 	//unsigned char Data_Copy[16];
 
 	unsigned char Old_Data[16] = {
@@ -157,12 +183,10 @@ void Calculate_MIC(unsigned char *Data, unsigned char *Final_MIC, unsigned char
 		Number_of_Blocks++;
 	}
 
-	Generate_Keys(Key_K1, Key_K2, NwkSkey);
-
 	//Preform Calculation on Block B0
 
 	//Preform AES encryption
-	AES_Encrypt(Block_B, NwkSkey);
+	AES_Encrypt_Expanded(Block_B, Round_Keys);
 
 	//Copy Block_B to Old_Data
 	for(i = 0; i < 16; i++)
@@ -184,7 +208,7 @@ void Calculate_MIC(unsigned char *Data, unsigned char *Final_MIC, unsigned char
 		XOR(New_Data,Old_Data);
 
 		//Preform AES encryption
-		AES_Encrypt(New_Data, NwkSkey);
+		AES_Encrypt_Expanded(New_Data, Round_Keys);
 
 		//Copy New_Data to Old_Data
 		for(i = 0; i < 16; i++)
@@ -208,13 +232,13 @@ void Calculate_MIC(unsigned char *Data, unsigned char *Final_MIC, unsigned char
 		}
 
 		//Preform XOR with Key 1
-		XOR(New_Data,Key_K1);
+		XOR(New_Data,K1);
 
 		//Preform XOR with old data
 		XOR(New_Data,Old_Data);
 
 		//Preform last AES routine
-		AES_Encrypt(New_Data, NwkSkey);
+		AES_Encrypt_Expanded(New_Data, Round_Keys);
 	}
 	else
 	{
@@ -237,13 +261,13 @@ void Calculate_MIC(unsigned char *Data, unsigned char *Final_MIC, unsigned char
 		}
 
 		//Preform XOR with Key 2
-		XOR(New_Data,Key_K2);
+		XOR(New_Data,K2);
 
 		//Preform XOR with Old data
 		XOR(New_Data,Old_Data);
 
 		//Preform last AES routine
-		AES_Encrypt(New_Data, NwkSkey);
+		AES_Encrypt_Expanded(New_Data, Round_Keys);
 	}
 
 	Final_MIC[0] = New_Data[0];
@@ -253,12 +277,21 @@ void Calculate_MIC(unsigned char *Data, unsigned char *Final_MIC, unsigned char
 }
 
 void Generate_Keys(unsigned char *K1, unsigned char *K2, unsigned char NwkSkey[16])
+{
+	unsigned char Round_Keys[AES_ROUND_KEYS_LENGTH];
+
+	AES_Expand_Key(NwkSkey, Round_Keys);
+
+	Generate_Keys_Expanded(K1, K2, Round_Keys);
+}
+
+void Generate_Keys_Expanded(unsigned char *K1, unsigned char *K2, unsigned char *Round_Keys)
 {
 	unsigned char i;
 	unsigned char MSB_Key;
 
 	//Encrypt the zeros in K1 with the NwkSkey
-	AES_Encrypt(K1, NwkSkey);
+	AES_Encrypt_Expanded(K1, Round_Keys);
 
 	//Create K1
 	//Check if MSB is 1
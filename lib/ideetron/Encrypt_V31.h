@@ -32,8 +32,17 @@ void Calculate_MIC(unsigned char *Data, unsigned char *Final_MIC, unsigned char
 void Encrypt_Payload(unsigned char *Data, unsigned char Data_Length, unsigned int Frame_Counter,
                      unsigned char Direction, unsigned char Key[16], unsigned char DevAddr[4]);
 
+void Calculate_MIC_Expanded(unsigned char *Data, unsigned char *Final_MIC, unsigned char Data_Length,
+                            unsigned int Frame_Counter, unsigned char Direction, unsigned char *Round_Keys,
+                            unsigned char K1[16], unsigned char K2[16], unsigned char DevAddr[4]);
+
+void Encrypt_Payload_Expanded(unsigned char *Data, unsigned char Data_Length, unsigned int Frame_Counter,
+                              unsigned char Direction, unsigned char *Round_Keys, unsigned char DevAddr[4]);
+
 void Generate_Keys(unsigned char *K1, unsigned char *K2, unsigned char NwkSkey[16]);
 
+void Generate_Keys_Expanded(unsigned char *K1, unsigned char *K2, unsigned char *Round_Keys);
+
 void Shift_Left(unsigned char *Data);
 
 void XOR(unsigned char *New_Data,unsigned char *Old_Data);
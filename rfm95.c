@@ -1,11 +1,65 @@
 #include "rfm95.h"
 #include "lib/ideetron/Encrypt_V31.h"
+#include "lib/ideetron/AES-128_V10.h"
 
 #include <assert.h>
 #include <string.h>
 
 #define RFM9x_VER 0x12
 
+#define RFM95_MAC_HEADER_UNCONFIRMED_DATA_UP 0x40
+#define RFM95_MAC_HEADER_UNCONFIRMED_DATA_DOWN 0x60
+#define RFM95_MAC_HEADER_CONFIRMED_DATA_UP 0x80
+#define RFM95_MAC_HEADER_CONFIRMED_DATA_DOWN 0xa0
+
+#define RFM95_FRAME_CONTROL_ACK 0x20
+
+#define RFM95_ACK_TIMEOUT_MIN 1000
+#define RFM95_ACK_TIMEOUT_RANDOM 2000
+
+#define RFM95_NB_TRANS_MAX 15
+
+#define RFM95_FRAME_CONTROL_FRAME_PENDING 0x10
+#define RFM95_FRAME_CONTROL_CLASS_B 0x10
+
+#define RFM95_CHANNEL_SELECT_ATTEMPTS 4
+#define RFM95_CHANNEL_SNR_FAIR 0
+#define RFM95_CHANNEL_SNR_POOR -7
+
+#define RFM95_LBT_MAX_ATTEMPTS 4
+#define RFM95_LBT_BACKOFF_SLOTS 8
+#define RFM95_LBT_BACKOFF_SLOT_MS 20
+
+#define RFM95_POWER_MIN 2
+#define RFM95_POWER_CONTROL_MARGIN_TARGET 10
+#define RFM95_POWER_CONTROL_HYSTERESIS 3
+#define RFM95_POWER_CONTROL_STEP_DOWN_MAX 3
+#define RFM95_POWER_CONTROL_MISSED_MAX 2
+
+#define RFM95_BEACON_PERIOD_S 128
+#define RFM95_BEACON_RESERVED_MS 2120
+#define RFM95_BEACON_PREAMBLE_LENGTH 10
+#define RFM95_BEACONLESS_OPERATION_MAX 56
+#define RFM95_PING_SLOT_MS 30
+#define RFM95_CLASS_B_WINDOW_SYMBOLS 8
+#define RFM95_CLASS_B_MIN_LEAD_TIME 5
+
+#define RFM95_FRAGMENT_DATA_FRAGMENT 0x08
+
+/**
+ * Events feeding into the per channel link statistics.
+ */
+typedef enum
+{
+	RFM95_CHANNEL_EVENT_TX_SUCCESS,
+	RFM95_CHANNEL_EVENT_TX_FAILURE,
+	RFM95_CHANNEL_EVENT_ACK,
+	RFM95_CHANNEL_EVENT_MISSED_ACK,
+	RFM95_CHANNEL_EVENT_DOWNLINK,
+	RFM95_CHANNEL_EVENT_CAD_CLEAR,
+	RFM95_CHANNEL_EVENT_CAD_BUSY
+} rfm95_channel_event_t;
+
 /**
  * Registers addresses.
  */
@@ -16,14 +70,21 @@ typedef enum
 	RFM95_REGISTER_FR_MSB = 0x06,
 	RFM95_REGISTER_FR_MID = 0x07,
 	RFM95_REGISTER_FR_LSB = 0x08,
+	RFM95_REGISTER_FSK_BITRATE_MSB = 0x02,
+	RFM95_REGISTER_FSK_BITRATE_LSB = 0x03,
+	RFM95_REGISTER_FSK_FDEV_MSB = 0x04,
+	RFM95_REGISTER_FSK_FDEV_LSB = 0x05,
 	RFM95_REGISTER_PA_CONFIG = 0x09,
+	RFM95_REGISTER_PA_RAMP = 0x0A,
 	RFM95_REGISTER_LNA = 0x0C,
 	RFM95_REGISTER_FIFO_ADDR_PTR = 0x0D,
 	RFM95_REGISTER_FIFO_TX_BASE_ADDR = 0x0E,
 	RFM95_REGISTER_FIFO_RX_BASE_ADDR = 0x0F,
+	RFM95_REGISTER_FIFO_RX_CURRENT_ADDR = 0x10,
 	RFM95_REGISTER_IRQ_FLAGS = 0x12,
 	RFM95_REGISTER_FIFO_RX_BYTES_NB = 0x13,
 	RFM95_REGISTER_PACKET_SNR = 0x19,
+	RFM95_REGISTER_PACKET_RSSI = 0x1A,
 	RFM95_REGISTER_MODEM_CONFIG_1 = 0x1D,
 	RFM95_REGISTER_MODEM_CONFIG_2 = 0x1E,
 	RFM95_REGISTER_SYMB_TIMEOUT_LSB = 0x1F,
@@ -32,12 +93,29 @@ typedef enum
 	RFM95_REGISTER_PAYLOAD_LENGTH = 0x22,
 	RFM95_REGISTER_MAX_PAYLOAD_LENGTH = 0x23,
 	RFM95_REGISTER_MODEM_CONFIG_3 = 0x26,
+	RFM95_REGISTER_DETECTION_OPTIMIZE = 0x31,
 	RFM95_REGISTER_INVERT_IQ_1 = 0x33,
+	RFM95_REGISTER_DETECTION_THRESHOLD = 0x37,
 	RFM95_REGISTER_SYNC_WORD = 0x39,
 	RFM95_REGISTER_INVERT_IQ_2 = 0x3B,
 	RFM95_REGISTER_DIO_MAPPING_1 = 0x40,
 	RFM95_REGISTER_VERSION = 0x42,
-	RFM95_REGISTER_PA_DAC = 0x4D
+	RFM95_REGISTER_PA_DAC = 0x4D,
+
+	// The FSK modem maps its own registers onto the addresses from 0x0D to 0x3F.
+	RFM95_REGISTER_FSK_RX_CONFIG = 0x0D,
+	RFM95_REGISTER_FSK_RX_BW = 0x12,
+	RFM95_REGISTER_FSK_AFC_BW = 0x13,
+	RFM95_REGISTER_FSK_PREAMBLE_DETECT = 0x1F,
+	RFM95_REGISTER_FSK_PREAMBLE_MSB = 0x25,
+	RFM95_REGISTER_FSK_PREAMBLE_LSB = 0x26,
+	RFM95_REGISTER_FSK_SYNC_CONFIG = 0x27,
+	RFM95_REGISTER_FSK_SYNC_VALUE_1 = 0x28,
+	RFM95_REGISTER_FSK_PACKET_CONFIG_1 = 0x30,
+	RFM95_REGISTER_FSK_PACKET_CONFIG_2 = 0x31,
+	RFM95_REGISTER_FSK_PAYLOAD_LENGTH = 0x32,
+	RFM95_REGISTER_FSK_FIFO_THRESH = 0x35,
+	RFM95_REGISTER_FSK_IRQ_FLAGS_2 = 0x3F
 } rfm95_register_t;
 
 typedef struct
@@ -56,13 +134,57 @@ typedef struct
 #define RFM95_REGISTER_OP_MODE_LORA_SLEEP                       0x80
 #define RFM95_REGISTER_OP_MODE_LORA_STANDBY                     0x81
 #define RFM95_REGISTER_OP_MODE_LORA_TX                          0x83
+#define RFM95_REGISTER_OP_MODE_LORA_RX_CONTINUOUS               0x85
 #define RFM95_REGISTER_OP_MODE_LORA_RX_SINGLE                   0x86
+#define RFM95_REGISTER_OP_MODE_LORA_CAD                         0x87
+#define RFM95_REGISTER_OP_MODE_FSK_STANDBY                      0x01
+#define RFM95_REGISTER_OP_MODE_FSK_TX                           0x03
+#define RFM95_REGISTER_OP_MODE_FSK_RX                           0x05
 
 #define RFM95_REGISTER_PA_DAC_LOW_POWER                         0x84
 #define RFM95_REGISTER_PA_DAC_HIGH_POWER                        0x87
 
 #define RFM95_REGISTER_DIO_MAPPING_1_IRQ_FOR_TXDONE             0x40
 #define RFM95_REGISTER_DIO_MAPPING_1_IRQ_FOR_RXDONE             0x00
+#define RFM95_REGISTER_DIO_MAPPING_1_IRQ_FOR_CAD                0xa0
+#define RFM95_REGISTER_DIO_MAPPING_1_FSK_PACKET                 0x00
+
+#define RFM95_REGISTER_IRQ_FLAGS_CAD_DETECTED                   0x01
+#define RFM95_REGISTER_IRQ_FLAGS_RX_DONE                        0x40
+
+#define RFM95_REGISTER_MODEM_CONFIG_1_IMPLICIT_HEADER           0x01
+#define RFM95_REGISTER_MODEM_CONFIG_1_CODING_RATE_4_5           0x02
+#define RFM95_REGISTER_MODEM_CONFIG_2_RX_PAYLOAD_CRC_ON         0x04
+#define RFM95_REGISTER_MODEM_CONFIG_3_AGC_AUTO_ON               0x04
+#define RFM95_REGISTER_MODEM_CONFIG_3_LOW_DATA_RATE_OPTIMIZE    0x08
+
+#define RFM95_REGISTER_DETECTION_OPTIMIZE_SF6                   0x05
+#define RFM95_REGISTER_DETECTION_OPTIMIZE_SF7_TO_SF12           0x03
+#define RFM95_REGISTER_DETECTION_THRESHOLD_SF6                  0x0c
+#define RFM95_REGISTER_DETECTION_THRESHOLD_SF7_TO_SF12          0x0a
+
+#define RFM95_REGISTER_PA_RAMP_NO_SHAPING                       0x09
+#define RFM95_REGISTER_PA_RAMP_GAUSSIAN_BT_0_5                  0x49
+
+#define RFM95_REGISTER_FSK_RX_CONFIG_DEFAULT                    0x0e
+#define RFM95_REGISTER_FSK_RX_CONFIG_RESTART                    0x40
+#define RFM95_REGISTER_FSK_PREAMBLE_DETECT_2_BYTES              0xaa
+#define RFM95_REGISTER_FSK_SYNC_CONFIG_AUTO_RESTART_SYNC_ON     0x50
+#define RFM95_REGISTER_FSK_PACKET_CONFIG_1_VARIABLE_LENGTH      0x80
+#define RFM95_REGISTER_FSK_PACKET_CONFIG_1_WHITENING            0x40
+#define RFM95_REGISTER_FSK_PACKET_CONFIG_1_CRC_ON               0x10
+#define RFM95_REGISTER_FSK_PACKET_CONFIG_1_CRC_AUTO_CLEAR_OFF   0x08
+#define RFM95_REGISTER_FSK_PACKET_CONFIG_2_PACKET_MODE          0x40
+#define RFM95_REGISTER_FSK_FIFO_THRESH_TX_START_NOT_EMPTY       0x80
+#define RFM95_REGISTER_FSK_IRQ_FLAGS_2_FIFO_LEVEL               0x20
+#define RFM95_REGISTER_FSK_IRQ_FLAGS_2_FIFO_OVERRUN             0x10
+#define RFM95_REGISTER_FSK_IRQ_FLAGS_2_PAYLOAD_READY            0x04
+#define RFM95_REGISTER_FSK_IRQ_FLAGS_2_CRC_OK                   0x02
+
+#define RFM95_WAKE_ON_RADIO_RX_SYMBOLS 16
+
+#define RFM95_FSK_FIFO_SIZE 64
+#define RFM95_FSK_FIFO_THRESHOLD 32
 
 #define RFM95_REGISTER_INVERT_IQ_1_TX                    		0x27
 #define RFM95_REGISTER_INVERT_IQ_2_TX							0x1d
@@ -70,46 +192,417 @@ typedef struct
 #define RFM95_REGISTER_INVERT_IQ_1_RX                    		0x67
 #define RFM95_REGISTER_INVERT_IQ_2_RX							0x19
 
-static bool read_register(rfm95_handle_t *handle, rfm95_register_t reg, uint8_t *buffer, size_t length)
+/**
+ * Spreading factor, bandwidth and maximum application payload length (N) of a data rate.
+ */
+typedef struct
 {
-	HAL_GPIO_WritePin(handle->nss_port, handle->nss_pin, GPIO_PIN_RESET);
+	uint8_t spreading_factor;
+	uint32_t bandwidth;
+	uint8_t max_payload_length;
+} rfm95_data_rate_config_t;
+
+/**
+ * Sub-band with its duty cycle limit, expressed as off time factor: a duty cycle of 1% requires an off time of 99 times
+ * the time on air.
+ */
+typedef struct
+{
+	uint32_t frequency_min;
+	uint32_t frequency_max;
+	uint16_t off_time_factor;
+} rfm95_sub_band_t;
 
-	uint8_t transmit_buffer = (uint8_t)reg & 0x7fu;
+/**
+ * Frequency register value of a frequency: FRF = (frequency * 2^19) / 32 MHz.
+ */
+#define RFM95_FRF(frequency) ((uint32_t)(((uint64_t)(frequency) << 19) / 32000000))
 
-	if (HAL_SPI_Transmit(handle->spi_handle, &transmit_buffer, 1, RFM95_SPI_TIMEOUT) != HAL_OK) {
-		return false;
+/**
+ * Channel with its frequency register values computed at compile time.
+ */
+#define RFM95_CHANNEL(frequency, min_data_rate, max_data_rate)                                                         \
+	{                                                                                                                  \
+		(frequency),                                                                                                   \
+		{ (uint8_t)(RFM95_FRF(frequency) >> 16), (uint8_t)(RFM95_FRF(frequency) >> 8), (uint8_t)RFM95_FRF(frequency) }, \
+		(min_data_rate), (max_data_rate)                                                                               \
 	}
 
-	if (HAL_SPI_Receive(handle->spi_handle, buffer, length, RFM95_SPI_TIMEOUT) != HAL_OK) {
-		return false;
+#if defined(RFM95_REGION_EU868)
+
+#define RFM95_FREQUENCY_MIN 863000000
+#define RFM95_FREQUENCY_MAX 870000000
+
+#define RFM95_DEFAULT_DATA_RATE RFM95_DATA_RATE_5
+#define RFM95_RX1_DATA_RATE_OFFSET_MAX 5
+#define RFM95_RX2_FREQUENCY 869525000
+#define RFM95_RX2_DATA_RATE RFM95_DATA_RATE_0
+
+#define RFM95_BEACON_FREQUENCY 869525000
+#define RFM95_BEACON_DATA_RATE RFM95_DATA_RATE_3
+#define RFM95_BEACON_RFU_LENGTH 2
+#define RFM95_BEACON_LENGTH 17
+
+static const rfm95_sub_band_t sub_bands[RFM95_SUB_BAND_COUNT] = {
+	{ 863000000, 868000000, 99 },
+	{ 868000000, 868600000, 99 },
+	{ 868700000, 869200000, 999 },
+	{ 869400000, 869650000, 9 },
+	{ 869700000, 870000000, 99 },
+	{ 0, UINT32_MAX, 999 } // Any other frequency is treated with the most restrictive limit.
+};
+
+static const rfm95_data_rate_config_t data_rate_configs[RFM95_DATA_RATE_COUNT] = {
+	{ 12, 125000, 51 },
+	{ 11, 125000, 51 },
+	{ 10, 125000, 51 },
+	{ 9, 125000, 115 },
+	{ 8, 125000, 242 },
+	{ 7, 125000, 242 },
+	{ 7, 250000, 242 }
+};
+
+static const rfm95_channel_config_t default_channels[] = {
+	RFM95_CHANNEL(868100000, RFM95_DATA_RATE_0, RFM95_DATA_RATE_5),
+	RFM95_CHANNEL(868300000, RFM95_DATA_RATE_0, RFM95_DATA_RATE_5),
+	RFM95_CHANNEL(868500000, RFM95_DATA_RATE_0, RFM95_DATA_RATE_5)
+};
+
+#elif defined(RFM95_REGION_US915) || defined(RFM95_REGION_AU915)
+
+#if RFM95_FIXED_CHANNEL_SUB_BAND < 1 || RFM95_FIXED_CHANNEL_SUB_BAND > 8
+#error "RFM95_FIXED_CHANNEL_SUB_BAND must be between 1 and 8"
+#endif
+
+#define RFM95_FIXED_CHANNEL_PLAN
+
+#if defined(RFM95_REGION_US915)
+
+#define RFM95_FREQUENCY_MIN 902000000
+#define RFM95_FREQUENCY_MAX 928000000
+
+#define RFM95_DEFAULT_DATA_RATE RFM95_DATA_RATE_3
+#define RFM95_RX1_DATA_RATE_BASE RFM95_DATA_RATE_10
+
+#define RFM95_NARROW_CHANNEL(n) RFM95_CHANNEL(902300000 + 200000 * (n), RFM95_DATA_RATE_0, RFM95_DATA_RATE_3)
+#define RFM95_WIDE_CHANNEL(n) RFM95_CHANNEL(903000000 + 1600000 * (n), RFM95_DATA_RATE_4, RFM95_DATA_RATE_4)
+
+static const rfm95_data_rate_config_t data_rate_configs[RFM95_DATA_RATE_COUNT] = {
+	{ 10, 125000, 11 },
+	{ 9, 125000, 53 },
+	{ 8, 125000, 125 },
+	{ 7, 125000, 242 },
+	{ 8, 500000, 242 },
+	{ 0, 0, 0 }, // RFU
+	{ 0, 0, 0 }, // RFU
+	{ 0, 0, 0 }, // RFU
+	{ 12, 500000, 53 },
+	{ 11, 500000, 129 },
+	{ 10, 500000, 242 },
+	{ 9, 500000, 242 },
+	{ 8, 500000, 242 },
+	{ 7, 500000, 242 }
+};
+
+#else
+
+#define RFM95_FREQUENCY_MIN 915000000
+#define RFM95_FREQUENCY_MAX 928000000
+
+#define RFM95_DEFAULT_DATA_RATE RFM95_DATA_RATE_5
+#define RFM95_RX1_DATA_RATE_BASE RFM95_DATA_RATE_8
+
+#define RFM95_NARROW_CHANNEL(n) RFM95_CHANNEL(915200000 + 200000 * (n), RFM95_DATA_RATE_0, RFM95_DATA_RATE_5)
+#define RFM95_WIDE_CHANNEL(n) RFM95_CHANNEL(915900000 + 1600000 * (n), RFM95_DATA_RATE_6, RFM95_DATA_RATE_6)
+
+static const rfm95_data_rate_config_t data_rate_configs[RFM95_DATA_RATE_COUNT] = {
+	{ 12, 125000, 51 },
+	{ 11, 125000, 51 },
+	{ 10, 125000, 51 },
+	{ 9, 125000, 115 },
+	{ 8, 125000, 242 },
+	{ 7, 125000, 242 },
+	{ 8, 500000, 242 },
+	{ 0, 0, 0 }, // RFU
+	{ 12, 500000, 53 },
+	{ 11, 500000, 129 },
+	{ 10, 500000, 242 },
+	{ 9, 500000, 242 },
+	{ 8, 500000, 242 },
+	{ 7, 500000, 242 }
+};
+
+#endif
+
+#define RFM95_RX1_DATA_RATE_OFFSET_MAX 3
+#define RFM95_RX2_FREQUENCY 923300000
+#define RFM95_RX2_DATA_RATE RFM95_DATA_RATE_8
+
+// Beacon channel hopping is not supported, beacons are expected on the first down-link channel.
+#define RFM95_BEACON_FREQUENCY 923300000
+#define RFM95_BEACON_DATA_RATE RFM95_DATA_RATE_8
+#define RFM95_BEACON_RFU_LENGTH 5
+#define RFM95_BEACON_LENGTH 23
+
+static const rfm95_sub_band_t sub_bands[RFM95_SUB_BAND_COUNT] = {
+	{ 0, UINT32_MAX, 0 } // No duty cycle limit, dwell time is kept by the data rates.
+};
+
+#define RFM95_SUB_BAND_FIRST_CHANNEL (8 * (RFM95_FIXED_CHANNEL_SUB_BAND - 1))
+
+static const rfm95_channel_config_t default_channels[] = {
+	RFM95_NARROW_CHANNEL(RFM95_SUB_BAND_FIRST_CHANNEL + 0),
+	RFM95_NARROW_CHANNEL(RFM95_SUB_BAND_FIRST_CHANNEL + 1),
+	RFM95_NARROW_CHANNEL(RFM95_SUB_BAND_FIRST_CHANNEL + 2),
+	RFM95_NARROW_CHANNEL(RFM95_SUB_BAND_FIRST_CHANNEL + 3),
+	RFM95_NARROW_CHANNEL(RFM95_SUB_BAND_FIRST_CHANNEL + 4),
+	RFM95_NARROW_CHANNEL(RFM95_SUB_BAND_FIRST_CHANNEL + 5),
+	RFM95_NARROW_CHANNEL(RFM95_SUB_BAND_FIRST_CHANNEL + 6),
+	RFM95_NARROW_CHANNEL(RFM95_SUB_BAND_FIRST_CHANNEL + 7),
+	RFM95_WIDE_CHANNEL(RFM95_FIXED_CHANNEL_SUB_BAND - 1)
+};
+
+/**
+ * Down-link channels used for RX1, up-link channel n is answered on channel n modulo 8.
+ */
+static const rfm95_channel_config_t rx1_channels[8] = {
+	RFM95_CHANNEL(923300000, RFM95_DATA_RATE_8, RFM95_DATA_RATE_13),
+	RFM95_CHANNEL(923900000, RFM95_DATA_RATE_8, RFM95_DATA_RATE_13),
+	RFM95_CHANNEL(924500000, RFM95_DATA_RATE_8, RFM95_DATA_RATE_13),
+	RFM95_CHANNEL(925100000, RFM95_DATA_RATE_8, RFM95_DATA_RATE_13),
+	RFM95_CHANNEL(925700000, RFM95_DATA_RATE_8, RFM95_DATA_RATE_13),
+	RFM95_CHANNEL(926300000, RFM95_DATA_RATE_8, RFM95_DATA_RATE_13),
+	RFM95_CHANNEL(926900000, RFM95_DATA_RATE_8, RFM95_DATA_RATE_13),
+	RFM95_CHANNEL(927500000, RFM95_DATA_RATE_8, RFM95_DATA_RATE_13)
+};
+
+#elif defined(RFM95_REGION_AS923)
+
+#define RFM95_FREQUENCY_MIN 915000000
+#define RFM95_FREQUENCY_MAX 928000000
+
+#define RFM95_DEFAULT_DATA_RATE RFM95_DATA_RATE_5
+#define RFM95_RX1_DATA_RATE_OFFSET_MAX 5
+#define RFM95_RX2_FREQUENCY 923200000
+#define RFM95_RX2_DATA_RATE RFM95_DATA_RATE_2
+
+#define RFM95_BEACON_FREQUENCY 923400000
+#define RFM95_BEACON_DATA_RATE RFM95_DATA_RATE_3
+#define RFM95_BEACON_RFU_LENGTH 2
+#define RFM95_BEACON_LENGTH 17
+
+static const rfm95_sub_band_t sub_bands[RFM95_SUB_BAND_COUNT] = {
+	{ 0, UINT32_MAX, 99 }
+};
+
+static const rfm95_data_rate_config_t data_rate_configs[RFM95_DATA_RATE_COUNT] = {
+	{ 12, 125000, 51 },
+	{ 11, 125000, 51 },
+	{ 10, 125000, 115 },
+	{ 9, 125000, 115 },
+	{ 8, 125000, 242 },
+	{ 7, 125000, 242 },
+	{ 7, 250000, 242 }
+};
+
+static const rfm95_channel_config_t default_channels[] = {
+	RFM95_CHANNEL(923200000, RFM95_DATA_RATE_0, RFM95_DATA_RATE_5),
+	RFM95_CHANNEL(923400000, RFM95_DATA_RATE_0, RFM95_DATA_RATE_5)
+};
+
+#elif defined(RFM95_REGION_IN865)
+
+#define RFM95_FREQUENCY_MIN 865000000
+#define RFM95_FREQUENCY_MAX 867000000
+
+#define RFM95_DEFAULT_DATA_RATE RFM95_DATA_RATE_5
+#define RFM95_RX1_DATA_RATE_OFFSET_MAX 5
+#define RFM95_RX2_FREQUENCY 866550000
+#define RFM95_RX2_DATA_RATE RFM95_DATA_RATE_2
+
+#define RFM95_BEACON_FREQUENCY 866550000
+#define RFM95_BEACON_DATA_RATE RFM95_DATA_RATE_4
+#define RFM95_BEACON_RFU_LENGTH 1
+#define RFM95_BEACON_LENGTH 19
+
+static const rfm95_sub_band_t sub_bands[RFM95_SUB_BAND_COUNT] = {
+	{ 0, UINT32_MAX, 0 }
+};
+
+static const rfm95_data_rate_config_t data_rate_configs[RFM95_DATA_RATE_COUNT] = {
+	{ 12, 125000, 51 },
+	{ 11, 125000, 51 },
+	{ 10, 125000, 51 },
+	{ 9, 125000, 115 },
+	{ 8, 125000, 242 },
+	{ 7, 125000, 242 },
+	{ 0, 0, 0 } // RFU
+};
+
+static const rfm95_channel_config_t default_channels[] = {
+	RFM95_CHANNEL(865062500, RFM95_DATA_RATE_0, RFM95_DATA_RATE_5),
+	RFM95_CHANNEL(865402500, RFM95_DATA_RATE_0, RFM95_DATA_RATE_5),
+	RFM95_CHANNEL(865985000, RFM95_DATA_RATE_0, RFM95_DATA_RATE_5)
+};
+
+#endif
+
+#define RFM95_DEFAULT_CHANNEL_COUNT (sizeof(default_channels) / sizeof(default_channels[0]))
+
+static void handle_dio0_interrupt(rfm95_handle_t *handle);
+
+static volatile uint8_t *transaction_depth(rfm95_handle_t *handle)
+{
+	// A shared bus is busy while any of its devices is in a transaction, a device of its own only for itself.
+	return handle->bus != NULL ? &handle->bus->transaction_depth : &handle->transaction_depth;
+}
+
+static bool interrupt_deferred(rfm95_handle_t *const *handles, uint8_t handle_count)
+{
+	for (uint8_t i = 0; i < handle_count; i++) {
+		if (handles[i]->interrupt_deferred) return true;
 	}
+	return false;
+}
 
-	HAL_GPIO_WritePin(handle->nss_port, handle->nss_pin, GPIO_PIN_SET);
+static void transaction_begin(rfm95_handle_t *handle)
+{
+	(*transaction_depth(handle))++;
+}
 
-	return true;
+static void transaction_end(rfm95_handle_t *handle)
+{
+	volatile uint8_t *depth = transaction_depth(handle);
+
+	if (--*depth != 0) {
+		return;
+	}
+
+	rfm95_handle_t *const *handles = handle->bus != NULL ? handle->bus->handles : &handle;
+	uint8_t handle_count = handle->bus != NULL ? handle->bus->handle_count : 1;
+
+	// Interrupts arriving during the transaction were deferred, they are handled now that the bus is free. The bus is
+	// held while checking, so an interrupt arriving meanwhile is deferred again instead of handled twice. As it may be
+	// for a handle checked already, the flags are checked again once the bus is free.
+	do {
+		for (uint8_t i = 0; i < handle_count; i++) {
+			*depth = 1;
+			if (handles[i]->interrupt_deferred) {
+				handles[i]->interrupt_deferred = false;
+				handle_dio0_interrupt(handles[i]);
+			}
+			*depth = 0;
+		}
+	} while (interrupt_deferred(handles, handle_count));
 }
 
-static bool write_register(rfm95_handle_t *handle, rfm95_register_t reg, uint8_t value)
+static bool spi_transaction(rfm95_handle_t *handle, uint8_t address, const uint8_t *transmit, uint8_t *receive,
+                            size_t length)
 {
 	HAL_GPIO_WritePin(handle->nss_port, handle->nss_pin, GPIO_PIN_RESET);
 
-	uint8_t transmit_buffer[2] = {((uint8_t)reg | 0x80u), value};
+	bool success;
 
-	if (HAL_SPI_Transmit(handle->spi_handle, transmit_buffer, 2, RFM95_SPI_TIMEOUT) != HAL_OK) {
-		return false;
+	if (transmit != NULL && length == 1) {
+		// Single register writes go out in one transfer.
+		uint8_t transmit_buffer[2] = {address, transmit[0]};
+		success = HAL_SPI_Transmit(handle->spi_handle, transmit_buffer, 2, RFM95_SPI_TIMEOUT) == HAL_OK;
+	} else {
+		success = HAL_SPI_Transmit(handle->spi_handle, &address, 1, RFM95_SPI_TIMEOUT) == HAL_OK;
+
+		// The address advances with each byte (the FIFO pointer for the FIFO), so the buffer goes in one burst.
+		if (success && transmit != NULL) {
+			success = HAL_SPI_Transmit(handle->spi_handle, (uint8_t *)transmit, length, RFM95_SPI_TIMEOUT) == HAL_OK;
+		} else if (success) {
+			success = HAL_SPI_Receive(handle->spi_handle, receive, length, RFM95_SPI_TIMEOUT) == HAL_OK;
+		}
 	}
 
+	// NSS is released after a failed transfer too, the radio would otherwise take the next one as its continuation.
 	HAL_GPIO_WritePin(handle->nss_port, handle->nss_pin, GPIO_PIN_SET);
 
-	return true;
+	return success;
+}
+
+static void recover_spi(rfm95_handle_t *handle)
+{
+	// Bring the peripheral out of whatever state the failed transfer left it in.
+	HAL_SPI_Abort(handle->spi_handle);
+	HAL_SPI_DeInit(handle->spi_handle);
+	HAL_SPI_Init(handle->spi_handle);
+}
+
+static bool register_transaction(rfm95_handle_t *handle, rfm95_register_t reg, uint8_t address,
+                                 const uint8_t *transmit, uint8_t *receive, size_t length)
+{
+	transaction_begin(handle);
+
+	bool success = spi_transaction(handle, address, transmit, receive, length);
+
+	for (uint8_t retry = 0; !success && retry < RFM95_SPI_RETRY_COUNT; retry++) {
+		handle->fault_statistics.spi_error_count++;
+		recover_spi(handle);
+
+		// Register accesses can simply be repeated, FIFO accesses already moved the FIFO pointer.
+		if (reg == RFM95_REGISTER_FIFO_ACCESS) {
+			break;
+		}
+
+		success = spi_transaction(handle, address, transmit, receive, length);
+		if (success) {
+			handle->fault_statistics.spi_retry_success_count++;
+		}
+	}
+
+	if (!success) {
+		handle->fault_pending = true;
+	}
+
+	transaction_end(handle);
+
+	return success;
+}
+
+static bool read_register(rfm95_handle_t *handle, rfm95_register_t reg, uint8_t *buffer, size_t length)
+{
+	return register_transaction(handle, reg, (uint8_t)reg & 0x7fu, NULL, buffer, length);
+}
+
+static bool write_registers(rfm95_handle_t *handle, rfm95_register_t reg, const uint8_t *buffer, size_t length)
+{
+	return register_transaction(handle, reg, (uint8_t)reg | 0x80u, buffer, NULL, length);
+}
+
+static bool write_register(rfm95_handle_t *handle, rfm95_register_t reg, uint8_t value)
+{
+	return register_transaction(handle, reg, (uint8_t)reg | 0x80u, &value, NULL, 1);
+}
+
+static bool data_rate_is_valid(uint8_t data_rate)
+{
+	// Data rates reserved in the region have no spreading factor.
+	return data_rate < RFM95_DATA_RATE_COUNT && data_rate_configs[data_rate].spreading_factor != 0;
 }
 
-static void config_set_channel(rfm95_handle_t *handle, uint8_t channel_index, uint32_t frequency)
+#ifndef RFM95_FIXED_CHANNEL_PLAN
+static void config_set_channel(rfm95_handle_t *handle, uint8_t channel_index, uint32_t frequency,
+                               uint8_t min_data_rate, uint8_t max_data_rate)
 {
 	assert(channel_index < 16);
-	handle->config.channels[channel_index].frequency = frequency;
+
+	// The frequency register values are calculated once, switching to the channel later is a single burst write.
+	uint32_t frf = RFM95_FRF(frequency);
+
+	rfm95_channel_config_t *channel = &handle->config.channels[channel_index];
+	channel->frequency = frequency;
+	channel->frf[0] = (uint8_t)(frf >> 16);
+	channel->frf[1] = (uint8_t)(frf >> 8);
+	channel->frf[2] = (uint8_t)(frf >> 0);
+	channel->min_data_rate = min_data_rate;
+	channel->max_data_rate = max_data_rate;
 	handle->config.channel_mask |= (1 << channel_index);
 }
+#endif
 
 static void config_load_default(rfm95_handle_t *handle)
 {
@@ -117,680 +610,3838 @@ static void config_load_default(rfm95_handle_t *handle)
 	handle->config.tx_frame_count = 0;
 	handle->config.rx_frame_count = 0;
 	handle->config.rx1_delay = 1;
+	handle->config.tx_data_rate = RFM95_DEFAULT_DATA_RATE;
+	handle->config.rx1_data_rate_offset = 0;
+	handle->config.rx2_data_rate = RFM95_RX2_DATA_RATE;
+	handle->config.rx2_frequency = RFM95_RX2_FREQUENCY;
+	handle->config.nb_trans = RFM95_CONFIRMED_NB_TRANS;
 	handle->config.channel_mask = 0;
-	config_set_channel(handle, 0, 868100000);
-	config_set_channel(handle, 1, 868300000);
-	config_set_channel(handle, 2, 868500000);
+
+	// Default channels come with their frequency register values precomputed.
+	for (uint8_t i = 0; i < RFM95_DEFAULT_CHANNEL_COUNT; i++) {
+		handle->config.channels[i] = default_channels[i];
+		handle->config.channel_mask |= (1 << i);
+	}
 }
 
-static void reset(rfm95_handle_t *handle)
+static bool config_is_valid(rfm95_handle_t *handle)
 {
-	HAL_GPIO_WritePin(handle->nrst_port, handle->nrst_pin, GPIO_PIN_RESET);
-	HAL_Delay(1); // 0.1ms would theoretically be enough
-	HAL_GPIO_WritePin(handle->nrst_port, handle->nrst_pin, GPIO_PIN_SET);
-	HAL_Delay(5);
+	return handle->config.magic == RFM95_EEPROM_CONFIG_MAGIC &&
+	       data_rate_is_valid(handle->config.tx_data_rate) &&
+	       handle->config.rx1_data_rate_offset <= RFM95_RX1_DATA_RATE_OFFSET_MAX &&
+	       data_rate_is_valid(handle->config.rx2_data_rate) &&
+	       handle->config.nb_trans >= 1 && handle->config.nb_trans <= RFM95_NB_TRANS_MAX;
 }
 
-static bool configure_frequency(rfm95_handle_t *handle, uint32_t frequency)
+// A snapshot holds sequence number, length of the serialised config, the config and CRC.
+#define RFM95_SNAPSHOT_SIZE (2 + 1 + RFM95_STORAGE_IMAGE_SIZE + 2)
+
+// A journal slot holds sequence number, chunk index, chunk and CRC.
+#define RFM95_JOURNAL_SLOT_SIZE (2 + 1 + RFM95_JOURNAL_CHUNK_SIZE + 2)
+
+#define RFM95_JOURNAL_CHUNK_COUNT (RFM95_STORAGE_IMAGE_SIZE / RFM95_JOURNAL_CHUNK_SIZE)
+
+// Flag in the chunk index of the last journal record of a save.
+#define RFM95_JOURNAL_COMMIT 0x80
+
+static uint16_t crc16(const uint8_t *data, size_t length, uint16_t crc)
 {
-	// FQ = (FRF * 32 Mhz) / (2 ^ 19)
-	uint64_t frf = ((uint64_t)frequency << 19) / 32000000;
+	// CRC-16/CCITT
+	for (size_t i = 0; i < length; i++) {
+		crc ^= (uint16_t)data[i] << 8;
+		for (uint8_t bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+		}
+	}
 
-	if (!write_register(handle, RFM95_REGISTER_FR_MSB, (uint8_t)(frf >> 16))) return false;
-	if (!write_register(handle, RFM95_REGISTER_FR_MID, (uint8_t)(frf >> 8))) return false;
-	if (!write_register(handle, RFM95_REGISTER_FR_LSB, (uint8_t)(frf >> 0))) return false;
+	return crc;
+}
 
-	return true;
+static uint8_t *put_frequency(uint8_t *buffer, uint32_t frequency)
+{
+	// Frequencies are stored in 100Hz units as 24 bit values, as in the LoRaWAN MAC commands.
+	uint32_t value = frequency / 100;
+	*buffer++ = (uint8_t)value;
+	*buffer++ = (uint8_t)(value >> 8);
+	*buffer++ = (uint8_t)(value >> 16);
+	return buffer;
 }
 
-static bool configure_channel(rfm95_handle_t *handle, size_t channel_index)
+static uint32_t get_frequency(const uint8_t *buffer)
 {
-	assert(handle->config.channel_mask & (1 << channel_index));
-	return configure_frequency(handle, handle->config.channels[channel_index].frequency);
+	return (buffer[0] | (buffer[1] << 8) | ((uint32_t)buffer[2] << 16)) * 100;
 }
 
-static bool wait_for_irq(rfm95_handle_t *handle, rfm95_interrupt_t interrupt, uint32_t timeout_ms)
+size_t rfm95_serialize_config(const rfm95_eeprom_config_t *config, uint8_t buffer[RFM95_CONFIG_SERIALIZED_SIZE_MAX])
 {
-	uint32_t timeout_tick = handle->get_precision_tick() + timeout_ms * handle->precision_tick_frequency / 1000;
+	uint8_t *position = buffer;
+
+	*position++ = RFM95_CONFIG_FORMAT_VERSION;
+	*position++ = (uint8_t)config->rx_frame_count;
+	*position++ = (uint8_t)(config->rx_frame_count >> 8);
+	*position++ = (uint8_t)config->tx_frame_count;
+	*position++ = (uint8_t)(config->tx_frame_count >> 8);
+	*position++ = config->rx1_delay;
+	*position++ = config->tx_data_rate;
+	*position++ = config->rx1_data_rate_offset;
+	*position++ = config->rx2_data_rate;
+	position = put_frequency(position, config->rx2_frequency);
+	*position++ = config->nb_trans;
+	*position++ = (uint8_t)config->channel_mask;
+	*position++ = (uint8_t)(config->channel_mask >> 8);
+
+	// Only configured channels are stored, their frequency register values are recalculated on load.
+	for (uint8_t i = 0; i < 16; i++) {
+		if (config->channel_mask & (1 << i)) {
+			position = put_frequency(position, config->channels[i].frequency);
+			*position++ = (uint8_t)((config->channels[i].max_data_rate << 4) | config->channels[i].min_data_rate);
+		}
+	}
 
-	while (handle->interrupt_times[interrupt] == 0) {
-		if (handle->get_precision_tick() >= timeout_tick) {
+	uint16_t crc = crc16(buffer, position - buffer, 0xffff);
+	*position++ = (uint8_t)crc;
+	*position++ = (uint8_t)(crc >> 8);
+
+	return position - buffer;
+}
+
+bool rfm95_deserialize_config(rfm95_eeprom_config_t *config, const uint8_t *buffer, size_t length)
+{
+	// Configs stored by an older format version are migrated by a case of their own, reading their layout into the
+	// current fields and filling new ones with defaults.
+	switch (length == 0 ? 0 : buffer[0]) {
+		case 1:
+			break;
+		default:
 			return false;
+	}
+
+	if (length < 17) {
+		return false;
+	}
+
+	uint16_t channel_mask = buffer[13] | (buffer[14] << 8);
+	uint8_t channel_count = 0;
+	for (uint8_t i = 0; i < 16; i++) {
+		if (channel_mask & (1 << i)) {
+			channel_count++;
+		}
+	}
+
+	size_t config_length = 15 + channel_count * 4;
+	if (length < config_length + 2) {
+		return false;
+	}
+
+	uint16_t crc = crc16(buffer, config_length, 0xffff);
+	if (crc != (buffer[config_length] | (buffer[config_length + 1] << 8))) {
+		return false;
+	}
+
+	memset(config, 0, sizeof(*config));
+	config->magic = RFM95_EEPROM_CONFIG_MAGIC;
+	config->rx_frame_count = buffer[1] | (buffer[2] << 8);
+	config->tx_frame_count = buffer[3] | (buffer[4] << 8);
+	config->rx1_delay = buffer[5];
+	config->tx_data_rate = buffer[6];
+	config->rx1_data_rate_offset = buffer[7];
+	config->rx2_data_rate = buffer[8];
+	config->rx2_frequency = get_frequency(&buffer[9]);
+	config->nb_trans = buffer[12];
+	config->channel_mask = channel_mask;
+
+	const uint8_t *position = &buffer[15];
+	for (uint8_t i = 0; i < 16; i++) {
+		if (channel_mask & (1 << i)) {
+			rfm95_channel_config_t *channel = &config->channels[i];
+			channel->frequency = get_frequency(position);
+			uint32_t frf = RFM95_FRF(channel->frequency);
+			channel->frf[0] = (uint8_t)(frf >> 16);
+			channel->frf[1] = (uint8_t)(frf >> 8);
+			channel->frf[2] = (uint8_t)(frf >> 0);
+			channel->min_data_rate = position[3] & 0x0f;
+			channel->max_data_rate = position[3] >> 4;
+			position += 4;
 		}
 	}
 
 	return true;
 }
 
-static bool wait_for_rx_irqs(rfm95_handle_t *handle)
+static bool journal_write_snapshot(rfm95_handle_t *handle, const uint8_t *image, size_t length)
 {
-	uint32_t timeout_tick = handle->get_precision_tick() +
-	                        RFM95_RECEIVE_TIMEOUT * handle->precision_tick_frequency / 1000;
+	rfm95_journal_t *journal = &handle->journal;
 
-	while (handle->interrupt_times[RFM95_INTERRUPT_DIO0] == 0 && handle->interrupt_times[RFM95_INTERRUPT_DIO1] == 0) {
-		if (handle->get_precision_tick() >= timeout_tick) {
-			return false;
-		}
-	}
+	// The older snapshot is overwritten, the current one and its journal stay intact should the write be torn.
+	uint8_t index = journal->snapshot_index ^ 1;
+	uint32_t address = index * RFM95_SNAPSHOT_SIZE;
 
-	return handle->interrupt_times[RFM95_INTERRUPT_DIO0] != 0;
+	// Only the serialised config is written, the rest of the image is zero padding.
+	uint8_t header[3] = { (uint8_t)journal->sequence, (uint8_t)(journal->sequence >> 8), (uint8_t)length };
+	uint16_t crc = crc16(image, length, crc16(header, 3, 0xffff));
+	uint8_t crc_buffer[2] = { (uint8_t)crc, (uint8_t)(crc >> 8) };
+
+	if (!handle->storage_write(address, header, 3)) return false;
+	if (!handle->storage_write(address + 3, image, length)) return false;
+	if (!handle->storage_write(address + 3 + length, crc_buffer, 2)) return false;
+
+	journal->snapshot_index = index;
+	journal->sequence++;
+	journal->head = 0;
+
+	return true;
 }
 
-bool rfm95_set_power(rfm95_handle_t *handle, int8_t power)
+static bool journal_append(rfm95_handle_t *handle, uint8_t chunk, const uint8_t *data)
 {
-	assert((power >= 2 && power <= 17) || power == 20);
+	rfm95_journal_t *journal = &handle->journal;
+
+	uint8_t slot[RFM95_JOURNAL_SLOT_SIZE];
+	slot[0] = (uint8_t)journal->sequence;
+	slot[1] = (uint8_t)(journal->sequence >> 8);
+	slot[2] = chunk;
+	memcpy(&slot[3], data, RFM95_JOURNAL_CHUNK_SIZE);
+	uint16_t crc = crc16(slot, RFM95_JOURNAL_SLOT_SIZE - 2, 0xffff);
+	slot[RFM95_JOURNAL_SLOT_SIZE - 2] = (uint8_t)crc;
+	slot[RFM95_JOURNAL_SLOT_SIZE - 1] = (uint8_t)(crc >> 8);
+
+	// A torn slot fails its CRC and ends the journal on reload, the slot is advanced past even if the write failed.
+	uint32_t address = 2 * RFM95_SNAPSHOT_SIZE + journal->head * RFM95_JOURNAL_SLOT_SIZE;
+	journal->head++;
+	journal->sequence++;
+
+	return handle->storage_write(address, slot, RFM95_JOURNAL_SLOT_SIZE);
+}
 
-	rfm95_register_pa_config_t pa_config = {0};
-	uint8_t pa_dac_config = 0;
+static bool journal_save(rfm95_handle_t *handle)
+{
+	rfm95_journal_t *journal = &handle->journal;
 
-	if (power >= 2 && power <= 17) {
-		pa_config.max_power = 7;
-		pa_config.pa_select = 1;
-		pa_config.output_power = (power - 2);
-		pa_dac_config = RFM95_REGISTER_PA_DAC_LOW_POWER;
+	uint8_t image[RFM95_STORAGE_IMAGE_SIZE] = { 0 };
+	rfm95_eeprom_config_t config = handle->config;
 
-	} else if (power == 20) {
-		pa_config.max_power = 7;
-		pa_config.pa_select = 1;
-		pa_config.output_power = 15;
-		pa_dac_config = RFM95_REGISTER_PA_DAC_HIGH_POWER;
+	// The TX frame counter is only committed every RFM95_FRAME_COUNT_COMMIT_INTERVAL frames, reloading skips ahead by
+	// as much so counter values are never reused.
+	if (journal->image_valid &&
+	    (uint16_t)(config.tx_frame_count - journal->committed_tx_frame_count) < RFM95_FRAME_COUNT_COMMIT_INTERVAL) {
+		config.tx_frame_count = journal->committed_tx_frame_count;
+	}
+	size_t length = rfm95_serialize_config(&config, image);
+
+	// Without a stored image to compare against, everything is written as a snapshot.
+	if (!journal->image_valid) {
+		if (!journal_write_snapshot(handle, image, length)) return false;
+		memcpy(journal->image, image, RFM95_STORAGE_IMAGE_SIZE);
+		journal->image_valid = true;
+		journal->committed_tx_frame_count = config.tx_frame_count;
+		return true;
 	}
 
-	if (!write_register(handle, RFM95_REGISTER_PA_CONFIG, pa_config.buffer)) return false;
-	if (!write_register(handle, RFM95_REGISTER_PA_DAC, pa_dac_config)) return false;
+	uint8_t changed_chunks[RFM95_JOURNAL_CHUNK_COUNT];
+	uint8_t changed_count = 0;
+	for (uint8_t chunk = 0; chunk < RFM95_JOURNAL_CHUNK_COUNT; chunk++) {
+		if (memcmp(&image[chunk * RFM95_JOURNAL_CHUNK_SIZE], &journal->image[chunk * RFM95_JOURNAL_CHUNK_SIZE],
+		           RFM95_JOURNAL_CHUNK_SIZE) != 0) {
+			changed_chunks[changed_count++] = chunk;
+		}
+	}
+
+	// The last record of a save is marked as commit, the save only applies on reload once it was written. A save not
+	// fitting the remaining journal is folded into a new snapshot instead.
+	if (journal->head + changed_count > journal->slot_count) {
+		if (!journal_write_snapshot(handle, image, length)) return false;
+	} else {
+		for (uint8_t i = 0; i < changed_count; i++) {
+			uint8_t chunk = changed_chunks[i];
+			uint8_t commit = i + 1 == changed_count ? RFM95_JOURNAL_COMMIT : 0;
+
+			// After a failed write the journal has a gap the next reload stops at, so the next save starts a new
+			// snapshot.
+			if (!journal_append(handle, chunk | commit, &image[chunk * RFM95_JOURNAL_CHUNK_SIZE])) {
+				journal->image_valid = false;
+				return false;
+			}
+		}
+	}
+
+	memcpy(journal->image, image, RFM95_STORAGE_IMAGE_SIZE);
+	journal->committed_tx_frame_count = config.tx_frame_count;
 
 	return true;
 }
 
-bool rfm95_init(rfm95_handle_t *handle)
+static bool journal_load(rfm95_handle_t *handle)
 {
-	assert(handle->spi_handle->Init.Mode == SPI_MODE_MASTER);
-	assert(handle->spi_handle->Init.Direction == SPI_DIRECTION_2LINES);
-	assert(handle->spi_handle->Init.DataSize == SPI_DATASIZE_8BIT);
-	assert(handle->spi_handle->Init.CLKPolarity == SPI_POLARITY_LOW);
-	assert(handle->spi_handle->Init.CLKPhase == SPI_PHASE_1EDGE);
-	assert(handle->get_precision_tick != NULL);
-	assert(handle->random_int != NULL);
-	assert(handle->precision_sleep_until != NULL);
-	assert(handle->precision_tick_frequency > 10000);
+	rfm95_journal_t *journal = &handle->journal;
 
-	reset(handle);
+	journal->image_valid = false;
+	journal->slot_count = (handle->storage_size - 2 * RFM95_SNAPSHOT_SIZE) / RFM95_JOURNAL_SLOT_SIZE;
+	journal->head = 0;
 
-	// If there is reload function or the reload was unsuccessful or the magic does not match restore default.
-	if (handle->reload_config == NULL || !handle->reload_config(&handle->config) ||
-	    handle->config.magic != RFM95_EEPROM_CONFIG_MAGIC) {
-		config_load_default(handle);
-	}
+	// The newer of the two intact snapshots is the base the journal applies to.
+	uint16_t base_sequence = 0;
+	for (uint8_t index = 0; index < 2; index++) {
 
-	// Check for correct version.
-	uint8_t version;
-	if (!read_register(handle, RFM95_REGISTER_VERSION, &version, 1)) return false;
-	if (version != RFM9x_VER) return false;
+		uint8_t header[3];
+		uint8_t image[RFM95_STORAGE_IMAGE_SIZE] = { 0 };
+		uint8_t crc_buffer[2];
+		uint32_t address = index * RFM95_SNAPSHOT_SIZE;
 
-	// Module must be placed in sleep mode before switching to lora.
-	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_SLEEP)) return false;
-	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_SLEEP)) return false;
+		if (!handle->storage_read(address, header, 3)) return false;
 
-	// Default interrupt configuration, must be done to prevent DIO5 clock interrupts at 1Mhz
-	if (!write_register(handle, RFM95_REGISTER_DIO_MAPPING_1, RFM95_REGISTER_DIO_MAPPING_1_IRQ_FOR_RXDONE)) return false;
+		uint8_t length = header[2];
+		if (length > RFM95_STORAGE_IMAGE_SIZE) {
+			continue;
+		}
 
-	if (handle->on_after_interrupts_configured != NULL) {
-		handle->on_after_interrupts_configured();
+		if (!handle->storage_read(address + 3, image, length)) return false;
+		if (!handle->storage_read(address + 3 + length, crc_buffer, 2)) return false;
+
+		uint16_t crc = crc16(image, length, crc16(header, 3, 0xffff));
+		if (crc != (crc_buffer[0] | (crc_buffer[1] << 8))) {
+			continue;
+		}
+
+		uint16_t snapshot_sequence = header[0] | (header[1] << 8);
+		if (journal->image_valid && (int16_t)(snapshot_sequence - base_sequence) < 0) {
+			continue;
+		}
+
+		memcpy(journal->image, image, RFM95_STORAGE_IMAGE_SIZE);
+		journal->image_valid = true;
+		journal->snapshot_index = index;
+		base_sequence = snapshot_sequence;
 	}
 
-	// Set module power to 17dbm.
-	if (!rfm95_set_power(handle, 17)) return false;
+	// Journal records follow the snapshot in consecutive slots and sequence numbers. The records of a save only apply
+	// once its last one, marked as commit, is found, a save torn by a power loss is dropped as a whole. The next save
+	// continues right after the last commit and overwrites the torn records. Without an intact snapshot the records
+	// are still scanned, the defaults written instead must be numbered above all of them so they are never applied.
+	uint8_t pending_image[RFM95_STORAGE_IMAGE_SIZE];
+	memcpy(pending_image, journal->image, RFM95_STORAGE_IMAGE_SIZE);
 
-	// Set LNA to the highest gain with 150% boost.
-	if (!write_register(handle, RFM95_REGISTER_LNA, 0x23)) return false;
+	bool contiguous = journal->image_valid;
+	bool sequence_found = journal->image_valid;
+	uint16_t last_sequence = base_sequence;
+	for (uint16_t i = 0; i < journal->slot_count; i++) {
 
-	// Preamble set to 8 + 4.25 = 12.25 symbols.
-	if (!write_register(handle, RFM95_REGISTER_PREAMBLE_MSB, 0x00)) return false;
-	if (!write_register(handle, RFM95_REGISTER_PREAMBLE_LSB, 0x08)) return false;
+		uint8_t slot[RFM95_JOURNAL_SLOT_SIZE];
+		if (!handle->storage_read(2 * RFM95_SNAPSHOT_SIZE + i * RFM95_JOURNAL_SLOT_SIZE, slot, sizeof(slot))) {
+			return false;
+		}
 
-	// Set TTN sync word 0x34.
-	if (!write_register(handle, RFM95_REGISTER_SYNC_WORD, 0x34)) return false;
+		uint16_t crc = crc16(slot, RFM95_JOURNAL_SLOT_SIZE - 2, 0xffff);
+		uint16_t sequence = slot[0] | (slot[1] << 8);
+		uint8_t chunk = slot[2] & ~RFM95_JOURNAL_COMMIT;
 
-	// Set up TX and RX FIFO base addresses.
-	if (!write_register(handle, RFM95_REGISTER_FIFO_TX_BASE_ADDR, 0x80)) return false;
-	if (!write_register(handle, RFM95_REGISTER_FIFO_RX_BASE_ADDR, 0x00)) return false;
+		if (crc != (slot[RFM95_JOURNAL_SLOT_SIZE - 2] | (slot[RFM95_JOURNAL_SLOT_SIZE - 1] << 8))) {
+			contiguous = false;
+			continue;
+		}
+
+		if (!journal->image_valid) {
+			if (!sequence_found || (int16_t)(sequence - last_sequence) > 0) {
+				last_sequence = sequence;
+				sequence_found = true;
+			}
+			continue;
+		}
 
-	// Maximum payload length of the RFM95 is 64.
-	if (!write_register(handle, RFM95_REGISTER_MAX_PAYLOAD_LENGTH, 64)) return false;
+		if (!contiguous || chunk >= RFM95_JOURNAL_CHUNK_COUNT || sequence != (uint16_t)(base_sequence + 1 + i)) {
+			contiguous = false;
+			continue;
+		}
 
-	// Let module sleep after initialisation.
-	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_SLEEP)) return false;
+		memcpy(&pending_image[chunk * RFM95_JOURNAL_CHUNK_SIZE], &slot[3], RFM95_JOURNAL_CHUNK_SIZE);
+
+		if (slot[2] & RFM95_JOURNAL_COMMIT) {
+			memcpy(journal->image, pending_image, RFM95_STORAGE_IMAGE_SIZE);
+			last_sequence = sequence;
+			journal->head = i + 1;
+		}
+	}
+
+	journal->sequence = last_sequence + 1;
+
+	if (!journal->image_valid) {
+		return false;
+	}
+
+	// The snapshot and journal records passed their CRCs, the format CRC additionally covers their combination.
+	if (!rfm95_deserialize_config(&handle->config, journal->image, RFM95_STORAGE_IMAGE_SIZE)) {
+		return false;
+	}
+
+	// Frames sent since the last commit are skipped, the skipped-ahead value is committed right away.
+	journal->committed_tx_frame_count = handle->config.tx_frame_count;
+	handle->config.tx_frame_count += RFM95_FRAME_COUNT_COMMIT_INTERVAL;
 
 	return true;
 }
 
-static bool process_mac_commands(rfm95_handle_t *handle, const uint8_t *frame_payload,
-                                 size_t frame_payload_length, uint8_t answer_buffer[51], uint8_t *answer_buffer_length,
-                                 int8_t snr)
+static bool load_persisted_config(rfm95_handle_t *handle)
 {
-	uint8_t index = 0;
-	uint8_t answer_index = 0;
+	if (handle->storage_read != NULL) {
+		return journal_load(handle);
+	}
 
-	while (index < frame_payload_length) {
-		switch (frame_payload[index++])
-		{
-			case 0x01: // ResetConf
-			{
-				if (index >= frame_payload_length) return false;
+	return handle->reload_config != NULL && handle->reload_config(&handle->config);
+}
 
-				index += 1;
-				break;
-			}
-			case 0x02: // LinkCheckReq
-			{
-				if ((index + 1) >= frame_payload_length) return false;
+static bool persist_config(rfm95_handle_t *handle)
+{
+	if (handle->storage_write != NULL) {
+		return journal_save(handle);
+	}
 
-				index += 2;
-				break;
-			}
+	if (handle->save_config != NULL) {
+		handle->save_config(&(handle->config));
+	}
+
+	return true;
+}
+
+static void reset(rfm95_handle_t *handle)
+{
+	HAL_GPIO_WritePin(handle->nrst_port, handle->nrst_pin, GPIO_PIN_RESET);
+	HAL_Delay(1); // 0.1ms would theoretically be enough
+	HAL_GPIO_WritePin(handle->nrst_port, handle->nrst_pin, GPIO_PIN_SET);
+	HAL_Delay(5);
+}
+
+static bool configure_frequency(rfm95_handle_t *handle, uint32_t frequency)
+{
+	// FQ = (FRF * 32 Mhz) / (2 ^ 19)
+	uint32_t frf = RFM95_FRF(frequency);
+	uint8_t frf_buffer[3] = { (uint8_t)(frf >> 16), (uint8_t)(frf >> 8), (uint8_t)(frf >> 0) };
+
+	// MSB, MID and LSB registers are consecutive.
+	return write_registers(handle, RFM95_REGISTER_FR_MSB, frf_buffer, sizeof(frf_buffer));
+}
+
+static bool configure_channel(rfm95_handle_t *handle, size_t channel_index)
+{
+	assert(handle->config.channel_mask & (1 << channel_index));
+	return write_registers(handle, RFM95_REGISTER_FR_MSB, handle->config.channels[channel_index].frf, 3);
+}
+
+static uint16_t usable_channel_mask(rfm95_handle_t *handle)
+{
+	uint16_t channel_mask = 0;
+
+	// Only channels allowing the current data rate are used for up-links.
+	for (uint8_t i = 0; i < 16; i++) {
+		const rfm95_channel_config_t *channel = &handle->config.channels[i];
+		if ((handle->config.channel_mask & (1 << i)) && handle->config.tx_data_rate >= channel->min_data_rate &&
+		    handle->config.tx_data_rate <= channel->max_data_rate) {
+			channel_mask |= (1 << i);
+		}
+	}
+
+	// Without any matching channel, all enabled channels are used rather than none.
+	return channel_mask != 0 ? channel_mask : handle->config.channel_mask;
+}
+
+static uint32_t symbol_time_us(rfm95_data_rate_t data_rate)
+{
+	const rfm95_data_rate_config_t *dr = &data_rate_configs[data_rate];
+	return (uint32_t)(((uint64_t)1000000 << dr->spreading_factor) / dr->bandwidth);
+}
+
+uint32_t rfm95_time_on_air_us(uint8_t spreading_factor, uint32_t bandwidth, uint8_t coding_rate,
+                              uint16_t preamble_length, size_t payload_length, bool implicit_header, bool crc)
+{
+	assert(spreading_factor >= 6 && spreading_factor <= 12);
+	assert(coding_rate >= 1 && coding_rate <= 4);
+
+	// Low data rate optimization is used for symbol times above 16ms.
+	bool low_data_rate_optimize = ((uint64_t)1000000 << spreading_factor) / bandwidth > 16000;
+
+	// Number of payload symbols according to the SX1276 datasheet, section 4.1.1.7.
+	int32_t numerator = 8 * (int32_t)payload_length - 4 * spreading_factor + 28 + (crc ? 16 : 0) -
+	                    (implicit_header ? 20 : 0);
+	int32_t denominator = 4 * (spreading_factor - (low_data_rate_optimize ? 2 : 0));
+
+	uint32_t payload_symbols = 8;
+	if (numerator > 0) {
+		payload_symbols += ((numerator + denominator - 1) / denominator) * (coding_rate + 4);
+	}
+
+	// Preamble takes 4.25 symbols more than configured, calculate in quarter symbols to stay integer.
+	uint64_t quarter_symbols = 4 * (uint64_t)preamble_length + 17 + 4 * (uint64_t)payload_symbols;
+
+	return (uint32_t)(((quarter_symbols * 1000000) << spreading_factor) / (4 * (uint64_t)bandwidth));
+}
+
+static uint32_t data_rate_time_on_air_us(rfm95_data_rate_t data_rate, size_t payload_length)
+{
+	const rfm95_data_rate_config_t *dr = &data_rate_configs[data_rate];
+	return rfm95_time_on_air_us(dr->spreading_factor, dr->bandwidth, 1, 8, payload_length, false, true);
+}
+
+static size_t max_phy_payload_length(rfm95_data_rate_t data_rate)
+{
+	// MAC header, frame header, port and MIC take 13 bytes besides the application payload.
+	return data_rate_configs[data_rate].max_payload_length + 13;
+}
+
+static uint8_t channel_sub_band(rfm95_handle_t *handle, uint8_t channel_index)
+{
+	uint32_t frequency = handle->config.channels[channel_index].frequency;
+
+	uint8_t sub_band = 0;
+	while (frequency < sub_bands[sub_band].frequency_min || frequency >= sub_bands[sub_band].frequency_max) {
+		sub_band++;
+	}
+
+	return sub_band;
+}
+
+static bool is_sub_band_available(rfm95_handle_t *handle, uint8_t sub_band, uint32_t ticks)
+{
+	if ((handle->duty_cycle_restricted_sub_bands & (1 << sub_band)) == 0) {
+		return true;
+	}
+
+	if ((int32_t)(ticks - handle->duty_cycle_available_ticks[sub_band]) >= 0) {
+		handle->duty_cycle_restricted_sub_bands &= ~(1 << sub_band);
+		return true;
+	}
+
+	return false;
+}
+
+static void record_transmission(rfm95_handle_t *handle, uint8_t channel_index, uint32_t tx_done_ticks,
+                                uint32_t time_on_air_us)
+{
+	uint8_t sub_band = channel_sub_band(handle, channel_index);
+	uint32_t off_time_ticks = (uint32_t)((uint64_t)time_on_air_us * sub_bands[sub_band].off_time_factor *
+	                                     handle->precision_tick_frequency / 1000000);
+
+	handle->duty_cycle_available_ticks[sub_band] = tx_done_ticks + off_time_ticks;
+	handle->duty_cycle_restricted_sub_bands |= (1 << sub_band);
+}
+
+uint32_t rfm95_get_channel_available_ticks(rfm95_handle_t *handle, uint8_t channel_index)
+{
+	assert(handle->config.channel_mask & (1 << channel_index));
+
+	uint32_t now_ticks = handle->get_precision_tick();
+	uint8_t sub_band = channel_sub_band(handle, channel_index);
+
+	if (is_sub_band_available(handle, sub_band, now_ticks)) {
+		return now_ticks;
+	}
+
+	return handle->duty_cycle_available_ticks[sub_band];
+}
+
+uint32_t rfm95_get_next_tx_ticks(rfm95_handle_t *handle)
+{
+	uint32_t now_ticks = handle->get_precision_tick();
+	uint32_t next_tx_ticks = 0;
+	bool found = false;
+	uint16_t channel_mask = usable_channel_mask(handle);
+
+	for (uint8_t i = 0; i < 16; i++) {
+		if (channel_mask & (1 << i)) {
+			uint32_t channel_ticks = rfm95_get_channel_available_ticks(handle, i);
+			if (!found || (int32_t)(channel_ticks - next_tx_ticks) < 0) {
+				next_tx_ticks = channel_ticks;
+				found = true;
+			}
+		}
+	}
+
+	return found ? next_tx_ticks : now_ticks;
+}
+
+static uint8_t bandwidth_bits(uint32_t bandwidth)
+{
+	static const uint32_t bandwidths[] = {
+		7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000, 500000
+	};
+
+	for (uint8_t i = 0; i < sizeof(bandwidths) / sizeof(bandwidths[0]); i++) {
+		if (bandwidths[i] == bandwidth) {
+			return i;
+		}
+	}
+
+	assert(false);
+	return 0x7;
+}
+
+static bool configure_modem(rfm95_handle_t *handle, rfm95_data_rate_t data_rate, uint32_t symbol_timeout)
+{
+	assert(data_rate_is_valid(data_rate));
+	assert(symbol_timeout <= 0x3ff);
+
+	const rfm95_data_rate_config_t *dr = &data_rate_configs[data_rate];
+
+	uint8_t modem_config_1 = (bandwidth_bits(dr->bandwidth) << 4) | RFM95_REGISTER_MODEM_CONFIG_1_CODING_RATE_4_5;
+	uint8_t modem_config_2 = (dr->spreading_factor << 4) | RFM95_REGISTER_MODEM_CONFIG_2_RX_PAYLOAD_CRC_ON |
+	                         ((symbol_timeout >> 8) & 0x3);
+	uint8_t modem_config_3 = RFM95_REGISTER_MODEM_CONFIG_3_AGC_AUTO_ON;
+
+	// Low data rate optimization is mandated for symbol times above 16ms.
+	if (symbol_time_us(data_rate) > 16000) {
+		modem_config_3 |= RFM95_REGISTER_MODEM_CONFIG_3_LOW_DATA_RATE_OPTIMIZE;
+	}
+
+	if (!write_register(handle, RFM95_REGISTER_MODEM_CONFIG_1, modem_config_1)) return false;
+	if (!write_register(handle, RFM95_REGISTER_MODEM_CONFIG_2, modem_config_2)) return false;
+	if (!write_register(handle, RFM95_REGISTER_MODEM_CONFIG_3, modem_config_3)) return false;
+
+	// LoRaWAN preamble of 8 symbols, restored here as beacon reception uses a longer one and may be left early.
+	if (!write_register(handle, RFM95_REGISTER_PREAMBLE_MSB, 0x00)) return false;
+	if (!write_register(handle, RFM95_REGISTER_PREAMBLE_LSB, 0x08)) return false;
+
+	// Set maximum symbol timeout.
+	if (!write_register(handle, RFM95_REGISTER_SYMB_TIMEOUT_LSB, (uint8_t)symbol_timeout)) return false;
+
+	return true;
+}
+
+static bool wait_for_irq(rfm95_handle_t *handle, rfm95_interrupt_t interrupt, uint32_t timeout_ms)
+{
+	uint32_t timeout_tick = handle->get_precision_tick() +
+	                        (uint32_t)((uint64_t)timeout_ms * handle->precision_tick_frequency / 1000);
+
+	while (handle->interrupt_times[interrupt] == 0) {
+		if (handle->get_precision_tick() >= timeout_tick) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool wait_for_rx_irqs(rfm95_handle_t *handle, uint32_t timeout_ms)
+{
+	uint32_t timeout_tick = handle->get_precision_tick() +
+	                        (uint32_t)((uint64_t)timeout_ms * handle->precision_tick_frequency / 1000);
+
+	while (handle->interrupt_times[RFM95_INTERRUPT_DIO0] == 0 && handle->interrupt_times[RFM95_INTERRUPT_DIO1] == 0) {
+		if (handle->get_precision_tick() >= timeout_tick) {
+			return false;
+		}
+	}
+
+	return handle->interrupt_times[RFM95_INTERRUPT_DIO0] != 0;
+}
+
+bool rfm95_set_power(rfm95_handle_t *handle, int8_t power)
+{
+	assert((power >= 2 && power <= 17) || power == 20);
+
+	rfm95_register_pa_config_t pa_config = {0};
+	uint8_t pa_dac_config = 0;
+
+	if (power >= 2 && power <= 17) {
+		pa_config.max_power = 7;
+		pa_config.pa_select = 1;
+		pa_config.output_power = (power - 2);
+		pa_dac_config = RFM95_REGISTER_PA_DAC_LOW_POWER;
+
+	} else if (power == 20) {
+		pa_config.max_power = 7;
+		pa_config.pa_select = 1;
+		pa_config.output_power = 15;
+		pa_dac_config = RFM95_REGISTER_PA_DAC_HIGH_POWER;
+	}
+
+	if (!write_register(handle, RFM95_REGISTER_PA_CONFIG, pa_config.buffer)) return false;
+	if (!write_register(handle, RFM95_REGISTER_PA_DAC, pa_dac_config)) return false;
+
+	handle->tx_power = power;
+
+	return true;
+}
+
+void rfm95_set_data_rate(rfm95_handle_t *handle, rfm95_data_rate_t data_rate)
+{
+	assert(data_rate_is_valid(data_rate));
+
+	handle->config.tx_data_rate = data_rate;
+}
+
+static bool configure_lora(rfm95_handle_t *handle)
+{
+	// Module must be placed in sleep mode before switching to lora.
+	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_SLEEP)) return false;
+	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_SLEEP)) return false;
+
+	// Default interrupt configuration, must be done to prevent DIO5 clock interrupts at 1Mhz
+	if (!write_register(handle, RFM95_REGISTER_DIO_MAPPING_1, RFM95_REGISTER_DIO_MAPPING_1_IRQ_FOR_RXDONE)) return false;
+
+	// Preamble set to 8 + 4.25 = 12.25 symbols.
+	if (!write_register(handle, RFM95_REGISTER_PREAMBLE_MSB, 0x00)) return false;
+	if (!write_register(handle, RFM95_REGISTER_PREAMBLE_LSB, 0x08)) return false;
+
+	// Set TTN sync word 0x34.
+	if (!write_register(handle, RFM95_REGISTER_SYNC_WORD, 0x34)) return false;
+
+	// Detection settings for SF7 to SF12.
+	if (!write_register(handle, RFM95_REGISTER_DETECTION_OPTIMIZE, RFM95_REGISTER_DETECTION_OPTIMIZE_SF7_TO_SF12)) {
+		return false;
+	}
+	if (!write_register(handle, RFM95_REGISTER_DETECTION_THRESHOLD, RFM95_REGISTER_DETECTION_THRESHOLD_SF7_TO_SF12)) {
+		return false;
+	}
+
+	// Transmission and reception never overlap, so both use the whole 256 byte FIFO.
+	if (!write_register(handle, RFM95_REGISTER_FIFO_TX_BASE_ADDR, 0x00)) return false;
+	if (!write_register(handle, RFM95_REGISTER_FIFO_RX_BASE_ADDR, 0x00)) return false;
+
+	// Allow receiving phy payloads up to the regional maximum.
+	if (!write_register(handle, RFM95_REGISTER_MAX_PAYLOAD_LENGTH, RFM95_PHY_PAYLOAD_MAX_LENGTH)) return false;
+
+	return true;
+}
+
+bool rfm95_init(rfm95_handle_t *handle)
+{
+	assert(handle->spi_handle->Init.Mode == SPI_MODE_MASTER);
+	assert(handle->spi_handle->Init.Direction == SPI_DIRECTION_2LINES);
+	assert(handle->spi_handle->Init.DataSize == SPI_DATASIZE_8BIT);
+	assert(handle->spi_handle->Init.CLKPolarity == SPI_POLARITY_LOW);
+	assert(handle->spi_handle->Init.CLKPhase == SPI_PHASE_1EDGE);
+	assert(handle->get_precision_tick != NULL);
+	assert(handle->random_int != NULL);
+	assert(handle->precision_sleep_until != NULL);
+	assert(handle->precision_tick_frequency > 10000);
+	assert(handle->storage_read == NULL ||
+	       handle->storage_size >= 2 * RFM95_SNAPSHOT_SIZE + RFM95_JOURNAL_CHUNK_COUNT * RFM95_JOURNAL_SLOT_SIZE);
+
+	handle->transaction_depth = 0;
+	handle->interrupt_deferred = false;
+
+	reset(handle);
+	handle->fault_pending = false;
+
+	// If there is no stored config or it is invalid restore default.
+	if (!load_persisted_config(handle) || !config_is_valid(handle)) {
+		config_load_default(handle);
+		handle->journal.image_valid = false;
+	}
+
+	// Commit the skipped-ahead frame counter or the default config to the journal right away. Without the commit frame
+	// counter values could be reused after the next reset.
+	if (handle->storage_write != NULL && !journal_save(handle)) return false;
+
+	// Check for correct version.
+	uint8_t version;
+	if (!read_register(handle, RFM95_REGISTER_VERSION, &version, 1)) return false;
+	if (version != RFM9x_VER) return false;
+
+	// Switch to lora with the LoRaWAN modem settings and the default interrupt configuration.
+	if (!configure_lora(handle)) return false;
+
+	if (handle->on_after_interrupts_configured != NULL) {
+		handle->on_after_interrupts_configured();
+	}
+
+	// Set module power to 17dbm.
+	if (!rfm95_set_power(handle, 17)) return false;
+
+	// Set LNA to the highest gain with 150% boost.
+	if (!write_register(handle, RFM95_REGISTER_LNA, 0x23)) return false;
+
+	// Class B beacons and ping slots start out on the regional defaults.
+	handle->class_b.beacon_frequency = RFM95_BEACON_FREQUENCY;
+	handle->class_b.ping_slot_frequency = RFM95_BEACON_FREQUENCY;
+	handle->class_b.ping_slot_data_rate = RFM95_BEACON_DATA_RATE;
+
+	// Let module sleep after initialisation.
+	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_SLEEP)) return false;
+
+	return true;
+}
+
+static bool process_mac_commands(rfm95_handle_t *handle, const uint8_t *frame_payload,
+                                 size_t frame_payload_length, uint8_t answer_buffer[51], uint8_t *answer_buffer_length,
+                                 int8_t snr)
+{
+	size_t index = 0;
+	uint8_t answer_index = 0;
+
+	while (index < frame_payload_length) {
+		switch (frame_payload[index++])
+		{
+			case 0x01: // ResetConf
+			{
+				if (index >= frame_payload_length) return false;
+
+				index += 1;
+				break;
+			}
+			case 0x02: // LinkCheckAns
+			{
+				if ((index + 1) >= frame_payload_length) return false;
+
+				// The answer is evaluated by the power control once the receive windows are closed.
+				handle->power_control.margin = frame_payload[index++];
+				handle->power_control.gateway_count = frame_payload[index++];
+				handle->power_control.snr = snr;
+				handle->power_control.link_check_answered = true;
+				break;
+			}
 			case 0x03: // LinkADRReq
 			{
 				if ((index + 3) >= frame_payload_length) return false;
 
-				index += 4;
-				break;
-			}
-			case 0x04: // DutyCycleReq
-			{
-				if (index >= frame_payload_length) return false;
+				index += 4;
+				break;
+			}
+			case 0x04: // DutyCycleReq
+			{
+				if (index >= frame_payload_length) return false;
+
+				index += 1;
+				break;
+			}
+			case 0x05: // RXParamSetupReq
+			{
+				if ((index + 3) >= frame_payload_length) return false;
+				if ((answer_index + 2) >= 51) return false;
+
+				uint8_t dl_settings = frame_payload[index++];
+				uint8_t frequency_lsb = frame_payload[index++];
+				uint8_t frequency_msb = frame_payload[index++];
+				uint8_t frequency_hsb = frame_payload[index++];
+				uint32_t frequency = (frequency_lsb | (frequency_msb << 8) | (frequency_hsb << 16)) * 100;
+
+				uint8_t rx1_data_rate_offset = (dl_settings >> 4) & 0x07;
+				uint8_t rx2_data_rate = dl_settings & 0x0f;
+
+				bool frequency_ack = frequency >= RFM95_FREQUENCY_MIN && frequency <= RFM95_FREQUENCY_MAX;
+				bool rx2_data_rate_ack = data_rate_is_valid(rx2_data_rate);
+				bool rx1_data_rate_offset_ack = rx1_data_rate_offset <= RFM95_RX1_DATA_RATE_OFFSET_MAX;
+
+				// The settings must only be applied if all of them are acceptable.
+				if (frequency_ack && rx2_data_rate_ack && rx1_data_rate_offset_ack) {
+					handle->config.rx1_data_rate_offset = rx1_data_rate_offset;
+					handle->config.rx2_data_rate = rx2_data_rate;
+					handle->config.rx2_frequency = frequency;
+				}
+
+				answer_buffer[answer_index++] = 0x05;
+				answer_buffer[answer_index++] = (rx1_data_rate_offset_ack << 2) | (rx2_data_rate_ack << 1) | frequency_ack;
+				break;
+			}
+			case 0x06: // DevStatusReq
+			{
+				if ((answer_index + 3) >= 51) return false;
+
+				uint8_t margin = (uint8_t)(snr & 0x1f);
+				uint8_t battery_level = handle->get_battery_level == NULL ? 0xff : handle->get_battery_level();
+
+				answer_buffer[answer_index++] = 0x06;
+				answer_buffer[answer_index++] = battery_level;
+				answer_buffer[answer_index++] = margin;
+				break;
+			}
+			case 0x07: // NewChannelReq
+			{
+				if ((index + 4) >= frame_payload_length) return false;
+
+#ifdef RFM95_FIXED_CHANNEL_PLAN
+				// Fixed channel plans can not be extended, the command is not answered.
+				index += 5;
+#else
+				if ((answer_index + 2) >= 51) return false;
+
+				uint8_t channel_index = frame_payload[index++];
+				uint8_t frequency_lsb = frame_payload[index++];
+				uint8_t frequency_msb = frame_payload[index++];
+				uint8_t frequency_hsb = frame_payload[index++];
+				uint8_t min_max_dr = frame_payload[index++];
+
+				uint32_t frequency = (frequency_lsb | (frequency_msb << 8) | (frequency_hsb << 16)) * 100;
+				uint8_t min_dr = min_max_dr & 0x0f;
+				uint8_t max_dr = (min_max_dr >> 4) & 0x0f;
+
+				// Default channels can not be modified, a frequency of 0 disables the channel.
+				bool channel_index_ack = channel_index >= RFM95_DEFAULT_CHANNEL_COUNT && channel_index < 16;
+				bool frequency_ack = channel_index_ack &&
+				                     (frequency == 0 ||
+				                      (frequency >= RFM95_FREQUENCY_MIN && frequency <= RFM95_FREQUENCY_MAX));
+				bool data_rate_ack = channel_index_ack && min_dr <= max_dr && data_rate_is_valid(min_dr) &&
+				                     data_rate_is_valid(max_dr);
+
+				if (frequency_ack && data_rate_ack) {
+					if (frequency == 0) {
+						handle->config.channel_mask &= ~(1 << channel_index);
+					} else {
+						config_set_channel(handle, channel_index, frequency, min_dr, max_dr);
+					}
+				}
+
+				answer_buffer[answer_index++] = 0x07;
+				answer_buffer[answer_index++] = (data_rate_ack << 1) | frequency_ack;
+#endif
+				break;
+			}
+			case 0x08: // RXTimingSetupReq
+			{
+				if (index >= frame_payload_length) return false;
+				if ((answer_index + 2) >= 51) return false;
+
+				handle->config.rx1_delay = frame_payload[index++] & 0xf;
+				if (handle->config.rx1_delay == 0) {
+					handle->config.rx1_delay = 1;
+				}
+
+				answer_buffer[answer_index++] = 0x08;
+				break;
+			}
+			case 0x09: // TxParamSetupReq
+			{
+				if (index >= frame_payload_length) return false;
+
+				break;
+			}
+			case 0x0a: // DlChannelReq
+			{
+				if ((index + 4) >= frame_payload_length) return false;
+
+				break;
+			}
+			case 0x0b: // RekeyConf
+			{
+				if (index >= frame_payload_length) return false;
+
+				break;
+			}
+			case 0x0c: // ADRParamSetupReq
+			{
+				if (index >= frame_payload_length) return false;
+
+				break;
+			}
+			case 0x0d: // DeviceTimeReq
+			{
+				break;
+			}
+			case 0x10: // PingSlotInfoAns
+			{
+				break;
+			}
+			case 0x11: // PingSlotChannelReq
+			{
+				if ((index + 3) >= frame_payload_length) return false;
+				if ((answer_index + 2) >= 51) return false;
+
+				uint8_t frequency_lsb = frame_payload[index++];
+				uint8_t frequency_msb = frame_payload[index++];
+				uint8_t frequency_hsb = frame_payload[index++];
+				uint8_t data_rate = frame_payload[index++] & 0x0f;
+				uint32_t frequency = (frequency_lsb | (frequency_msb << 8) | (frequency_hsb << 16)) * 100;
+
+				// A frequency of 0 restores the default ping slot frequency.
+				if (frequency == 0) {
+					frequency = RFM95_BEACON_FREQUENCY;
+				}
+
+				bool frequency_ack = frequency >= RFM95_FREQUENCY_MIN && frequency <= RFM95_FREQUENCY_MAX;
+				bool data_rate_ack = data_rate_is_valid(data_rate);
+
+				if (frequency_ack && data_rate_ack) {
+					handle->class_b.ping_slot_frequency = frequency;
+					handle->class_b.ping_slot_data_rate = data_rate;
+				}
+
+				answer_buffer[answer_index++] = 0x11;
+				answer_buffer[answer_index++] = (data_rate_ack << 1) | frequency_ack;
+				break;
+			}
+			case 0x13: // BeaconFreqReq
+			{
+				if ((index + 2) >= frame_payload_length) return false;
+				if ((answer_index + 2) >= 51) return false;
+
+				uint8_t frequency_lsb = frame_payload[index++];
+				uint8_t frequency_msb = frame_payload[index++];
+				uint8_t frequency_hsb = frame_payload[index++];
+				uint32_t frequency = (frequency_lsb | (frequency_msb << 8) | (frequency_hsb << 16)) * 100;
+
+				// A frequency of 0 restores the default beacon frequency.
+				if (frequency == 0) {
+					frequency = RFM95_BEACON_FREQUENCY;
+				}
+
+				bool frequency_ack = frequency >= RFM95_FREQUENCY_MIN && frequency <= RFM95_FREQUENCY_MAX;
+
+				if (frequency_ack) {
+					handle->class_b.beacon_frequency = frequency;
+				}
+
+				answer_buffer[answer_index++] = 0x13;
+				answer_buffer[answer_index++] = frequency_ack;
+				break;
+			}
+		}
+	}
+
+	*answer_buffer_length = answer_index;
+	return true;
+}
+
+static bool receive_at_scheduled_time(rfm95_handle_t *handle, uint32_t scheduled_time)
+{
+	// Sleep until 1ms before the scheduled time.
+	handle->precision_sleep_until(scheduled_time - handle->precision_tick_frequency / 1000);
+
+	// Clear flags and previous interrupt time, configure mapping for RX done.
+	if (!write_register(handle, RFM95_REGISTER_DIO_MAPPING_1, RFM95_REGISTER_DIO_MAPPING_1_IRQ_FOR_RXDONE)) return false;
+	if (!write_register(handle, RFM95_REGISTER_IRQ_FLAGS, 0xff)) return false;
+	handle->interrupt_times[RFM95_INTERRUPT_DIO0] = 0;
+	handle->interrupt_times[RFM95_INTERRUPT_DIO1] = 0;
+	handle->interrupt_times[RFM95_INTERRUPT_DIO5] = 0;
+
+	// Move modem to lora standby.
+	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_STANDBY)) return false;
+
+	// Wait for the modem to be ready.
+	wait_for_irq(handle, RFM95_INTERRUPT_DIO5, RFM95_WAKEUP_TIMEOUT);
+
+	// Now sleep until the real scheduled time.
+	handle->precision_sleep_until(scheduled_time);
+
+	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_RX_SINGLE)) return false;
+
+	return true;
+}
+
+static void calculate_rx_timings(rfm95_handle_t *handle, rfm95_data_rate_t data_rate, uint32_t tx_ticks,
+                                 uint8_t rx_delay, uint32_t *rx_target, uint32_t *rx_window_symbols)
+{
+	volatile int32_t symbol_rate_us = (int32_t)symbol_time_us(data_rate);
+
+	// The clock drifts by precision_tick_drift_ns_per_s over each second of the window delay.
+	volatile int32_t rx_timing_error_us = (int32_t)((uint64_t)handle->precision_tick_drift_ns_per_s * rx_delay / 1000);
+	volatile int32_t rx_window_us = 2 * symbol_rate_us + 2 * rx_timing_error_us;
+	volatile int32_t rx_offset_us = 4 * symbol_rate_us - (rx_timing_error_us / 2);
+	volatile int32_t rx_offset_ticks = (int32_t)(((int64_t)rx_offset_us * (int64_t)handle->precision_tick_frequency) / 1000000);
+	*rx_target = tx_ticks + handle->precision_tick_frequency * rx_delay + rx_offset_ticks;
+	*rx_window_symbols = rx_window_us / symbol_rate_us;
+}
+
+static bool read_packet_quality(rfm95_handle_t *handle, rfm95_downlink_metadata_t *metadata)
+{
+	int8_t packet_snr;
+	if (!read_register(handle, RFM95_REGISTER_PACKET_SNR, (uint8_t *)&packet_snr, 1)) return false;
+	metadata->snr = (int8_t)(packet_snr / 4);
+	metadata->multicast = false;
+
+	uint8_t packet_rssi;
+	if (!read_register(handle, RFM95_REGISTER_PACKET_RSSI, &packet_rssi, 1)) return false;
+
+	// Packet RSSI for the high frequency port, corrected by the SNR for packets below the noise floor.
+	metadata->rssi = (int16_t)(-157 + packet_rssi);
+	if (packet_snr < 0) {
+		metadata->rssi += packet_snr / 4;
+	}
+
+	return true;
+}
+
+static bool read_package(rfm95_handle_t *handle, uint8_t *payload_buf, size_t *payload_len,
+                         rfm95_downlink_metadata_t *metadata);
+
+static rfm95_data_rate_t get_rx1_data_rate(rfm95_handle_t *handle)
+{
+#ifdef RFM95_FIXED_CHANNEL_PLAN
+	// RX1 uses the 500kHz down-link data rate matching the up-link, lowered by the configured offset.
+	int data_rate = RFM95_RX1_DATA_RATE_BASE + handle->config.tx_data_rate - handle->config.rx1_data_rate_offset;
+	if (data_rate < RFM95_DATA_RATE_8) return RFM95_DATA_RATE_8;
+	if (data_rate > RFM95_DATA_RATE_13) return RFM95_DATA_RATE_13;
+	return (rfm95_data_rate_t)data_rate;
+#else
+	// RX1 uses the data rate of the up-link lowered by the configured offset.
+	if (handle->config.tx_data_rate > handle->config.rx1_data_rate_offset) {
+		return handle->config.tx_data_rate - handle->config.rx1_data_rate_offset;
+	}
+	return RFM95_DATA_RATE_0;
+#endif
+}
+
+static bool configure_rx1_channel(rfm95_handle_t *handle, uint8_t channel)
+{
+#ifdef RFM95_FIXED_CHANNEL_PLAN
+	// Down-links are sent on a separate set of channels, the 500kHz up-link channel maps to its sub-band.
+	uint8_t rx1_channel = channel < 8 ? channel : RFM95_FIXED_CHANNEL_SUB_BAND - 1;
+	return write_registers(handle, RFM95_REGISTER_FR_MSB, rx1_channels[rx1_channel].frf, 3);
+#else
+	// RX1 uses the frequency of the up-link, which is still configured.
+	(void)handle;
+	(void)channel;
+	return true;
+#endif
+}
+
+static bool receive_package(rfm95_handle_t *handle, uint8_t channel, uint32_t tx_ticks, uint8_t *payload_buf,
+                            size_t *payload_len, rfm95_downlink_metadata_t *metadata)
+{
+	*payload_len = 0;
+
+	rfm95_data_rate_t rx1_data_rate = get_rx1_data_rate(handle);
+	if (!configure_rx1_channel(handle, channel)) return false;
+
+	uint32_t rx1_target, rx1_window_symbols;
+	calculate_rx_timings(handle, rx1_data_rate, tx_ticks, handle->config.rx1_delay, &rx1_target, &rx1_window_symbols);
+
+	// Configure modem for RX1 with the window size as symbol timeout.
+	if (!configure_modem(handle, rx1_data_rate, rx1_window_symbols)) return false;
+
+	// Set IQ registers according to AN1200.24.
+	if (!write_register(handle, RFM95_REGISTER_INVERT_IQ_1, RFM95_REGISTER_INVERT_IQ_1_RX)) return false;
+	if (!write_register(handle, RFM95_REGISTER_INVERT_IQ_2, RFM95_REGISTER_INVERT_IQ_2_RX)) return false;
+
+	receive_at_scheduled_time(handle, rx1_target);
+
+	metadata->rx_window = 1;
+
+	// If there was nothing received during RX1, try RX2.
+	uint32_t rx1_time_on_air_us = data_rate_time_on_air_us(rx1_data_rate, max_phy_payload_length(rx1_data_rate));
+	if (!wait_for_rx_irqs(handle, RFM95_RECEIVE_TIMEOUT + rx1_time_on_air_us / 1000)) {
+
+		// Return modem to sleep.
+		if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_SLEEP)) return false;
+
+		if (handle->receive_mode == RFM95_RECEIVE_MODE_RX1_ONLY) {
+			return true;
+		}
+
+		rfm95_data_rate_t rx2_data_rate = handle->config.rx2_data_rate;
+
+		uint32_t rx2_target, rx2_window_symbols;
+		// RX2 opens one second after RX1.
+		calculate_rx_timings(handle, rx2_data_rate, tx_ticks, handle->config.rx1_delay + 1, &rx2_target,
+		                     &rx2_window_symbols);
+
+		// Configure RX2 frequency and data rate.
+		if (!configure_frequency(handle, handle->config.rx2_frequency)) return false;
+		if (!configure_modem(handle, rx2_data_rate, rx2_window_symbols)) return false;
+
+		receive_at_scheduled_time(handle, rx2_target);
+
+		uint32_t rx2_time_on_air_us = data_rate_time_on_air_us(rx2_data_rate, max_phy_payload_length(rx2_data_rate));
+		if (!wait_for_rx_irqs(handle, RFM95_RECEIVE_TIMEOUT + rx2_time_on_air_us / 1000)) {
+			// No payload during in RX1 and RX2
+			if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_SLEEP)) return false;
+			return true;
+		}
+
+		metadata->rx_window = 2;
+	}
+
+	return read_package(handle, payload_buf, payload_len, metadata);
+}
+
+static bool read_package(rfm95_handle_t *handle, uint8_t *payload_buf, size_t *payload_len,
+                         rfm95_downlink_metadata_t *metadata)
+{
+	uint8_t irq_flags;
+	read_register(handle, RFM95_REGISTER_IRQ_FLAGS, &irq_flags, 1);
+
+	// Check if there was a CRC error.
+	if (irq_flags & 0x20) {
+		return true;
+	}
+
+	if (!read_packet_quality(handle, metadata)) return false;
+
+	// Read received payload length.
+	uint8_t payload_len_internal;
+	if (!read_register(handle, RFM95_REGISTER_FIFO_RX_BYTES_NB, &payload_len_internal, 1)) return false;
+
+	// Read received payload itself.
+	if (!write_register(handle, RFM95_REGISTER_FIFO_ADDR_PTR, 0)) return false;
+	if (!read_register(handle, RFM95_REGISTER_FIFO_ACCESS, payload_buf, payload_len_internal)) return false;
+
+	// Return modem to sleep.
+	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_SLEEP)) return false;
+
+	// Successful payload receive, set payload length to tell caller.
+	*payload_len = payload_len_internal;
+	return true;
+}
+
+static uint32_t us_to_ticks(rfm95_handle_t *handle, uint64_t us)
+{
+	return (uint32_t)((us * handle->precision_tick_frequency) / 1000000);
+}
+
+static uint16_t beacon_crc(const uint8_t *data, size_t length)
+{
+	uint16_t crc = 0x0000;
+
+	// CRC-16 with polynomial 0x1021 as used for the beacon fields.
+	for (size_t i = 0; i < length; i++) {
+		crc ^= (uint16_t)(data[i] << 8);
+		for (uint8_t bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+		}
+	}
+
+	return crc;
+}
+
+static bool configure_beacon_modem(rfm95_handle_t *handle, uint32_t symbol_timeout)
+{
+	if (!configure_frequency(handle, handle->class_b.beacon_frequency)) return false;
+	if (!configure_modem(handle, RFM95_BEACON_DATA_RATE, symbol_timeout)) return false;
+
+	// Beacons are sent in implicit header mode without payload CRC.
+	uint8_t modem_config_1;
+	uint8_t modem_config_2;
+	if (!read_register(handle, RFM95_REGISTER_MODEM_CONFIG_1, &modem_config_1, 1)) return false;
+	if (!read_register(handle, RFM95_REGISTER_MODEM_CONFIG_2, &modem_config_2, 1)) return false;
+	modem_config_1 |= RFM95_REGISTER_MODEM_CONFIG_1_IMPLICIT_HEADER;
+	modem_config_2 &= ~RFM95_REGISTER_MODEM_CONFIG_2_RX_PAYLOAD_CRC_ON;
+	if (!write_register(handle, RFM95_REGISTER_MODEM_CONFIG_1, modem_config_1)) return false;
+	if (!write_register(handle, RFM95_REGISTER_MODEM_CONFIG_2, modem_config_2)) return false;
+	if (!write_register(handle, RFM95_REGISTER_PAYLOAD_LENGTH, RFM95_BEACON_LENGTH)) return false;
+	if (!write_register(handle, RFM95_REGISTER_PREAMBLE_LSB, RFM95_BEACON_PREAMBLE_LENGTH)) return false;
+
+	// Beacons are sent with non-inverted IQ, unlike down-links.
+	if (!write_register(handle, RFM95_REGISTER_INVERT_IQ_1, RFM95_REGISTER_INVERT_IQ_1_TX)) return false;
+	if (!write_register(handle, RFM95_REGISTER_INVERT_IQ_2, RFM95_REGISTER_INVERT_IQ_2_TX)) return false;
+
+	return true;
+}
+
+static bool read_beacon(rfm95_handle_t *handle, uint32_t *beacon_time, bool *valid)
+{
+	*valid = false;
+
+	uint8_t irq_flags;
+	if (!read_register(handle, RFM95_REGISTER_IRQ_FLAGS, &irq_flags, 1)) return false;
+	if (!write_register(handle, RFM95_REGISTER_IRQ_FLAGS, 0xff)) return false;
+
+	if ((irq_flags & RFM95_REGISTER_IRQ_FLAGS_RX_DONE) == 0) {
+		return true;
+	}
+
+	uint8_t length;
+	uint8_t fifo_address;
+	if (!read_register(handle, RFM95_REGISTER_FIFO_RX_BYTES_NB, &length, 1)) return false;
+	if (!read_register(handle, RFM95_REGISTER_FIFO_RX_CURRENT_ADDR, &fifo_address, 1)) return false;
+
+	if (length != RFM95_BEACON_LENGTH) {
+		return true;
+	}
+
+	uint8_t beacon[RFM95_BEACON_LENGTH];
+	if (!write_register(handle, RFM95_REGISTER_FIFO_ADDR_PTR, fifo_address)) return false;
+	if (!read_register(handle, RFM95_REGISTER_FIFO_ACCESS, beacon, RFM95_BEACON_LENGTH)) return false;
+
+	// The network common part holds the regional number of RFU bytes and the GPS time, followed by their CRC. The
+	// gateway specific part is not used.
+	const uint8_t *time = &beacon[RFM95_BEACON_RFU_LENGTH];
+	uint16_t crc = time[4] | (time[5] << 8);
+	if (beacon_crc(beacon, RFM95_BEACON_RFU_LENGTH + 4) != crc) {
+		return true;
+	}
+
+	*beacon_time = time[0] | (time[1] << 8) | (time[2] << 16) | ((uint32_t)time[3] << 24);
+	*valid = true;
+	return true;
+}
+
+static uint16_t calculate_ping_offset(rfm95_handle_t *handle, uint32_t beacon_time, uint16_t ping_period)
+{
+	uint8_t key[16] = { 0 };
+	uint8_t block[16] = { 0 };
+
+	// Rand = aes128_encrypt(0, BeaconTime | DevAddr | pad16), both fields little endian.
+	block[0] = (uint8_t)beacon_time;
+	block[1] = (uint8_t)(beacon_time >> 8);
+	block[2] = (uint8_t)(beacon_time >> 16);
+	block[3] = (uint8_t)(beacon_time >> 24);
+	block[4] = handle->device_address[3];
+	block[5] = handle->device_address[2];
+	block[6] = handle->device_address[1];
+	block[7] = handle->device_address[0];
+
+	AES_Encrypt(block, key);
+
+	return (uint16_t)((block[0] + block[1] * 256) % ping_period);
+}
+
+static bool open_class_b_window(rfm95_handle_t *handle, uint32_t target_ticks, rfm95_data_rate_t data_rate,
+                                uint32_t drift_s, bool beacon, bool *received)
+{
+	*received = false;
+
+	// Widen the window by the worst case drift accumulated since the last received beacon.
+	uint32_t widening_us = (uint32_t)(((uint64_t)handle->precision_tick_drift_ns_per_s * drift_s) / 1000);
+	uint32_t window_symbols = RFM95_CLASS_B_WINDOW_SYMBOLS + 2 * widening_us / symbol_time_us(data_rate);
+	if (window_symbols > 0x3ff) {
+		window_symbols = 0x3ff;
+	}
+
+	if (beacon) {
+		if (!configure_beacon_modem(handle, window_symbols)) return false;
+	} else {
+		if (!configure_frequency(handle, handle->class_b.ping_slot_frequency)) return false;
+		if (!configure_modem(handle, data_rate, window_symbols)) return false;
+
+		// Set IQ registers according to AN1200.24.
+		if (!write_register(handle, RFM95_REGISTER_INVERT_IQ_1, RFM95_REGISTER_INVERT_IQ_1_RX)) return false;
+		if (!write_register(handle, RFM95_REGISTER_INVERT_IQ_2, RFM95_REGISTER_INVERT_IQ_2_RX)) return false;
+	}
+
+	if (!receive_at_scheduled_time(handle, target_ticks - us_to_ticks(handle, widening_us))) return false;
+
+	uint32_t window_us = window_symbols * symbol_time_us(data_rate) +
+	                     data_rate_time_on_air_us(data_rate, max_phy_payload_length(data_rate));
+	*received = wait_for_rx_irqs(handle, RFM95_RECEIVE_TIMEOUT + window_us / 1000);
+
+	if (!*received) {
+		if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_SLEEP)) return false;
+	}
+
+	return true;
+}
+
+static bool start_continuous_receive(rfm95_handle_t *handle)
+{
+	// Continuous reception uses the RX2 frequency and data rate.
+	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_STANDBY)) return false;
+	if (!configure_frequency(handle, handle->config.rx2_frequency)) return false;
+	if (!configure_modem(handle, handle->config.rx2_data_rate, 0)) return false;
+
+	// Set IQ registers according to AN1200.24.
+	if (!write_register(handle, RFM95_REGISTER_INVERT_IQ_1, RFM95_REGISTER_INVERT_IQ_1_RX)) return false;
+	if (!write_register(handle, RFM95_REGISTER_INVERT_IQ_2, RFM95_REGISTER_INVERT_IQ_2_RX)) return false;
+
+	// Enable rx-done interrupt and clear flags.
+	if (!write_register(handle, RFM95_REGISTER_DIO_MAPPING_1, RFM95_REGISTER_DIO_MAPPING_1_IRQ_FOR_RXDONE)) return false;
+	if (!write_register(handle, RFM95_REGISTER_IRQ_FLAGS, 0xff)) return false;
+	if (!write_register(handle, RFM95_REGISTER_FIFO_ADDR_PTR, 0x00)) return false;
+
+	// The interrupt handler reads packets from now on.
+	handle->continuous_receive_active = true;
+
+	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_RX_CONTINUOUS)) {
+		handle->continuous_receive_active = false;
+		return false;
+	}
+
+	return true;
+}
+
+static bool stop_continuous_receive(rfm95_handle_t *handle)
+{
+	if (!handle->continuous_receive_active) {
+		return true;
+	}
+
+	// Stop the interrupt handler from accessing the radio before leaving receive mode.
+	handle->continuous_receive_active = false;
+
+	return write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_SLEEP);
+}
+
+static void receive_continuous_packet(rfm95_handle_t *handle)
+{
+	uint8_t irq_flags;
+	if (!read_register(handle, RFM95_REGISTER_IRQ_FLAGS, &irq_flags, 1)) return;
+	if (!write_register(handle, RFM95_REGISTER_IRQ_FLAGS, 0xff)) return;
+
+	// Check if there was a CRC error.
+	if ((irq_flags & RFM95_REGISTER_IRQ_FLAGS_RX_DONE) == 0 || (irq_flags & 0x20)) {
+		return;
+	}
+
+	uint8_t head = handle->rx_ring_head;
+	uint8_t next_head = (head + 1) % RFM95_RX_RING_SIZE;
+
+	// Drop the packet if the consumer did not keep up.
+	if (next_head == handle->rx_ring_tail) {
+		handle->rx_ring_overflow_count++;
+		return;
+	}
+
+	rfm95_rx_packet_t *packet = &handle->rx_ring[head];
+
+	if (!read_packet_quality(handle, &packet->metadata)) return;
+	packet->metadata.rx_window = 0;
+
+	uint8_t length;
+	uint8_t fifo_address;
+	if (!read_register(handle, RFM95_REGISTER_FIFO_RX_BYTES_NB, &length, 1)) return;
+	if (!read_register(handle, RFM95_REGISTER_FIFO_RX_CURRENT_ADDR, &fifo_address, 1)) return;
+
+	// The slot holds RFM95_PHY_PAYLOAD_MAX_LENGTH bytes, as much as the 8 bit length can express.
+	if (!write_register(handle, RFM95_REGISTER_FIFO_ADDR_PTR, fifo_address)) return;
+	if (!read_register(handle, RFM95_REGISTER_FIFO_ACCESS, packet->payload, length)) return;
+	packet->length = length;
+
+	// Publish the packet to the consumer only once it is complete.
+	handle->rx_ring_head = next_head;
+}
+
+static bool send_package(rfm95_handle_t *handle, uint8_t *payload_buf, size_t payload_len, uint8_t channel,
+                         uint32_t *tx_ticks)
+{
+	// Configure channel for transmission.
+	if (!configure_channel(handle, channel)) return false;
+
+	// Configure modem for the up-link data rate (4/5 error coding rate, CRC enable, AGC auto on)
+	if (!configure_modem(handle, handle->config.tx_data_rate, 0)) return false;
+
+	// Set IQ registers according to AN1200.24.
+	if (!write_register(handle, RFM95_REGISTER_INVERT_IQ_1, RFM95_REGISTER_INVERT_IQ_1_TX)) return false;
+	if (!write_register(handle, RFM95_REGISTER_INVERT_IQ_2, RFM95_REGISTER_INVERT_IQ_2_TX)) return false;
+
+	// Set the payload length.
+	if (!write_register(handle, RFM95_REGISTER_PAYLOAD_LENGTH, payload_len)) return false;
+
+	// Enable tx-done interrupt, clear flags and previous interrupt time.
+	if (!write_register(handle, RFM95_REGISTER_DIO_MAPPING_1, RFM95_REGISTER_DIO_MAPPING_1_IRQ_FOR_TXDONE)) return false;
+	if (!write_register(handle, RFM95_REGISTER_IRQ_FLAGS, 0xff)) return false;
+	handle->interrupt_times[RFM95_INTERRUPT_DIO0] = 0;
+	handle->interrupt_times[RFM95_INTERRUPT_DIO5] = 0;
+
+	// Move modem to lora standby.
+	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_STANDBY)) return false;
+
+	// Wait for the modem to be ready.
+	wait_for_irq(handle, RFM95_INTERRUPT_DIO5, RFM95_WAKEUP_TIMEOUT);
+
+	// Set pointer to start of TX section in FIFO.
+	if (!write_register(handle, RFM95_REGISTER_FIFO_ADDR_PTR, 0x00)) return false;
+
+	// Write payload to FIFO.
+	if (!write_registers(handle, RFM95_REGISTER_FIFO_ACCESS, payload_buf, payload_len)) return false;
+
+	// Set modem to tx mode.
+	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_TX)) return false;
+
+	// Wait for the transfer complete interrupt.
+	uint32_t time_on_air_us = data_rate_time_on_air_us(handle->config.tx_data_rate, payload_len);
+	if (!wait_for_irq(handle, RFM95_INTERRUPT_DIO0, RFM95_SEND_TIMEOUT + time_on_air_us / 1000)) return false;
+
+	// Set real tx time in ticks.
+	*tx_ticks = handle->interrupt_times[RFM95_INTERRUPT_DIO0];
+
+	// Account the transmission in the duty cycle ledger of the sub-band.
+	record_transmission(handle, channel, *tx_ticks, time_on_air_us);
+
+	// Return modem to sleep.
+	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_SLEEP)) return false;
+
+	return true;
+}
+
+size_t rfm95_get_max_payload_length(rfm95_handle_t *handle)
+{
+	size_t max_payload_length = data_rate_configs[handle->config.tx_data_rate].max_payload_length;
+
+	// Queued MAC command answers are sent in the frame options and count against the regional maximum. At low data
+	// rates of fixed channel plans they may take all of it, the up-link then sends them on their own first.
+	if (handle->pending_mac_answers_length >= max_payload_length) {
+		return 0;
+	}
+
+	return max_payload_length - handle->pending_mac_answers_length;
+}
+
+static size_t encode_phy_payload(rfm95_handle_t *handle, uint8_t payload_buf[RFM95_PHY_PAYLOAD_MAX_LENGTH],
+                                 bool confirmed, const uint8_t *frame_opts, size_t frame_opts_length,
+                                 const uint8_t *frame_payload, size_t frame_payload_length, uint8_t port)
+{
+	size_t payload_len = 0;
+
+	assert(frame_opts_length <= RFM95_FRAME_OPTIONS_MAX_LENGTH);
+
+	// Frame options and payload are limited by the regional maximum of the data rate.
+	assert(frame_opts_length + frame_payload_length <=
+	       data_rate_configs[handle->config.tx_data_rate].max_payload_length);
+
+	payload_buf[0] = confirmed ? RFM95_MAC_HEADER_CONFIRMED_DATA_UP : RFM95_MAC_HEADER_UNCONFIRMED_DATA_UP;
+	payload_buf[1] = handle->device_address[3];
+	payload_buf[2] = handle->device_address[2];
+	payload_buf[3] = handle->device_address[1];
+	payload_buf[4] = handle->device_address[0];
+	payload_buf[5] = (handle->pending_ack ? RFM95_FRAME_CONTROL_ACK : 0) | (uint8_t)frame_opts_length; // Frame Control
+
+	// Tell the network that ping slots are open.
+	if (handle->receive_mode == RFM95_RECEIVE_MODE_CLASS_B && handle->class_b.beacon_locked) {
+		payload_buf[5] |= RFM95_FRAME_CONTROL_CLASS_B;
+	}
+	payload_buf[6] = (handle->config.tx_frame_count & 0x00ffu);
+	payload_buf[7] = ((uint16_t)(handle->config.tx_frame_count >> 8u) & 0x00ffu);
+	payload_len += 8;
+
+	// Frame options are sent unencrypted but covered by the MIC.
+	memcpy(payload_buf + payload_len, frame_opts, frame_opts_length);
+	payload_len += frame_opts_length;
+
+	// The port and frame payload are only present if there is a frame payload.
+	if (frame_payload_length != 0) {
+
+		payload_buf[payload_len] = port; // Frame Port
+		payload_len += 1;
+
+		// Encrypt payload in place in payload_buf.
+		memcpy(payload_buf + payload_len, frame_payload, frame_payload_length);
+		if (port == 0) {
+			Encrypt_Payload(payload_buf + payload_len, frame_payload_length, handle->config.tx_frame_count,
+			                0, handle->network_session_key, handle->device_address);
+		} else {
+			Encrypt_Payload(payload_buf + payload_len, frame_payload_length, handle->config.tx_frame_count,
+			                0, handle->application_session_key, handle->device_address);
+		}
+		payload_len += frame_payload_length;
+	}
+
+	// Calculate MIC and copy to last 4 bytes of the payload_buf.
+	uint8_t mic[4];
+	Calculate_MIC(payload_buf, mic, payload_len, handle->config.tx_frame_count, 0,
+	              handle->network_session_key, handle->device_address);
+	for (uint8_t i = 0; i < 4; i++) {
+		payload_buf[payload_len + i] = mic[i];
+	}
+	payload_len += 4;
+
+	return payload_len;
+}
+
+/**
+ * Fields of a successfully decoded down-link frame.
+ */
+typedef struct
+{
+	uint8_t *mac_commands;
+	uint8_t mac_commands_length;
+	uint8_t *frame_payload;
+	uint8_t frame_payload_length;
+	uint8_t frame_port;
+	bool confirmed;
+	bool ack;
+	bool frame_pending;
+	bool multicast;
+} rfm95_decoded_frame_t;
+
+static uint32_t device_address_to_int(const uint8_t device_address[4])
+{
+	return ((uint32_t)device_address[0] << 24) | ((uint32_t)device_address[1] << 16) |
+	       ((uint32_t)device_address[2] << 8) | (uint32_t)device_address[3];
+}
+
+static rfm95_multicast_session_t *find_multicast_session(rfm95_handle_t *handle, uint32_t device_address)
+{
+	// Sessions are kept sorted by device address, allowing for a binary search.
+	uint8_t low = 0;
+	uint8_t high = handle->multicast_session_count;
+
+	while (low < high) {
+		uint8_t middle = (low + high) / 2;
+		uint32_t middle_address = device_address_to_int(handle->multicast_sessions[middle].device_address);
+
+		if (middle_address == device_address) {
+			return &handle->multicast_sessions[middle];
+		} else if (middle_address < device_address) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	return NULL;
+}
+
+static bool decode_multicast_phy_payload(rfm95_multicast_session_t *session,
+                                         uint8_t payload_buf[RFM95_PHY_PAYLOAD_MAX_LENGTH], uint8_t payload_length,
+                                         rfm95_decoded_frame_t *frame)
+{
+	// Multicast frames are always unconfirmed and carry neither frame options nor MAC commands.
+	if (payload_buf[0] != RFM95_MAC_HEADER_UNCONFIRMED_DATA_DOWN || (payload_buf[5] & 0x0f) != 0 ||
+	    payload_length < 13) {
+		return false;
+	}
+
+	uint16_t rx_frame_count = (payload_buf[7] << 8) | payload_buf[6];
+	uint8_t frame_port = payload_buf[8];
+
+	if (rx_frame_count < session->rx_frame_count || frame_port == 0) {
+		return false;
+	}
+
+	// The session's key material is expanded once when the session is added.
+	uint8_t check_mic[4];
+	Calculate_MIC_Expanded(payload_buf, check_mic, payload_length - 4, rx_frame_count, 1, session->network_round_keys,
+	                       session->mic_subkey_1, session->mic_subkey_2, session->device_address);
+	if (memcmp(check_mic, &payload_buf[payload_length - 4], 4) != 0) {
+		return false;
+	}
+
+	session->rx_frame_count = rx_frame_count;
+
+	uint8_t frame_payload_length = payload_length - 13;
+	Encrypt_Payload_Expanded(&payload_buf[9], frame_payload_length, rx_frame_count, 1, session->application_round_keys,
+	                         session->device_address);
+
+	frame->confirmed = false;
+	frame->ack = false;
+	frame->frame_pending = false;
+	frame->multicast = true;
+	frame->mac_commands = &payload_buf[9];
+	frame->mac_commands_length = 0;
+	frame->frame_port = frame_port;
+	frame->frame_payload = &payload_buf[9];
+	frame->frame_payload_length = frame_payload_length;
+
+	return true;
+}
+
+static bool decode_phy_payload(rfm95_handle_t *handle, uint8_t payload_buf[RFM95_PHY_PAYLOAD_MAX_LENGTH],
+                               uint8_t payload_length, rfm95_decoded_frame_t *frame)
+{
+	// MAC header, frame header without options and MIC are required.
+	if (payload_length < 12) {
+		return false;
+	}
+
+	// Only unconfirmed and confirmed data down-links are supported.
+	if (payload_buf[0] != RFM95_MAC_HEADER_UNCONFIRMED_DATA_DOWN &&
+	    payload_buf[0] != RFM95_MAC_HEADER_CONFIRMED_DATA_DOWN) {
+		return false;
+	}
+
+	// Does the device address match? Otherwise the frame might be addressed to a multicast group.
+	if (payload_buf[1] != handle->device_address[3] || payload_buf[2] != handle->device_address[2] ||
+	    payload_buf[3] != handle->device_address[1] || payload_buf[4] != handle->device_address[0]) {
+
+		uint32_t device_address = ((uint32_t)payload_buf[4] << 24) | ((uint32_t)payload_buf[3] << 16) |
+		                          ((uint32_t)payload_buf[2] << 8) | (uint32_t)payload_buf[1];
+
+		rfm95_multicast_session_t *session = find_multicast_session(handle, device_address);
+		if (session == NULL) {
+			return false;
+		}
+
+		return decode_multicast_phy_payload(session, payload_buf, payload_length, frame);
+	}
+
+	uint8_t frame_control = payload_buf[5];
+	uint8_t frame_opts_length = frame_control & 0x0f;
+	uint16_t rx_frame_count = (payload_buf[7] << 8) | payload_buf[6];
+
+	if (frame_opts_length > payload_length - 12) {
+		return false;
+	}
+
+	// Check if rx frame count is valid.
+	if (rx_frame_count < handle->config.rx_frame_count) {
+		return false;
+	}
+
+	uint8_t check_mic[4];
+	Calculate_MIC(payload_buf, check_mic, payload_length - 4, rx_frame_count, 1,
+	              handle->network_session_key, handle->device_address);
+	if (memcmp(check_mic, &payload_buf[payload_length - 4], 4) != 0) {
+		return false;
+	}
+
+	// Only update the rx frame count for authentic frames.
+	handle->config.rx_frame_count = rx_frame_count;
+
+	frame->confirmed = payload_buf[0] == RFM95_MAC_HEADER_CONFIRMED_DATA_DOWN;
+	frame->ack = (frame_control & RFM95_FRAME_CONTROL_ACK) != 0;
+	frame->frame_pending = (frame_control & RFM95_FRAME_CONTROL_FRAME_PENDING) != 0;
+	frame->multicast = false;
+
+	// MAC commands are carried in the frame options unless sent as frame payload on port 0.
+	frame->mac_commands = &payload_buf[8];
+	frame->mac_commands_length = frame_opts_length;
+
+	if (payload_length - 12 - frame_opts_length == 0) {
+		frame->frame_port = 0;
+		frame->frame_payload = &payload_buf[8 + frame_opts_length];
+		frame->frame_payload_length = 0;
+
+	} else {
+		frame->frame_port = payload_buf[8 + frame_opts_length];
+
+		uint8_t frame_payload_start = 9 + frame_opts_length;
+		uint8_t frame_payload_end = payload_length - 4;
+		uint8_t frame_payload_length = frame_payload_end - frame_payload_start;
+
+		if (frame->frame_port == 0) {
+			Encrypt_Payload(&payload_buf[frame_payload_start], frame_payload_length, rx_frame_count,
+			                1, handle->network_session_key, handle->device_address);
+		} else {
+			Encrypt_Payload(&payload_buf[frame_payload_start], frame_payload_length, rx_frame_count,
+			                1, handle->application_session_key, handle->device_address);
+		}
+
+		if (frame->frame_port == 0) {
+			frame->mac_commands = &payload_buf[frame_payload_start];
+			frame->mac_commands_length = frame_payload_length;
+			frame_payload_length = 0;
+		}
+
+		frame->frame_payload = &payload_buf[frame_payload_start];
+		frame->frame_payload_length = frame_payload_length;
+	}
+
+	return true;
+}
+
+static uint8_t channel_weight(const rfm95_channel_statistics_t *statistics)
+{
+	uint8_t penalty = statistics->tx_failures + statistics->missed_acks + statistics->cad_busy;
+
+	if (statistics->downlink_count != 0 && statistics->snr < RFM95_CHANNEL_SNR_POOR) {
+		penalty += 2;
+	} else if (statistics->downlink_count != 0 && statistics->snr < RFM95_CHANNEL_SNR_FAIR) {
+		penalty += 1;
+	}
+
+	// Every channel keeps a weight of at least one, so no channel is excluded entirely.
+	return penalty >= RFM95_CHANNEL_WEIGHT_MAX ? 1 : RFM95_CHANNEL_WEIGHT_MAX - penalty;
+}
+
+static void rebuild_channel_schedule(rfm95_handle_t *handle, uint16_t channel_mask)
+{
+	uint8_t length = 0;
+
+	// Each channel gets a number of slots equal to its weight, derived from its link statistics.
+	for (uint8_t i = 0; i < 16; i++) {
+
+		if ((channel_mask & (1 << i)) == 0) {
+			continue;
+		}
+
+		uint8_t weight = channel_weight(&handle->channel_statistics[i]);
+
+		for (uint8_t slot = 0; slot < weight; slot++) {
+			handle->channel_schedule[length++] = i;
+		}
+	}
+
+	handle->channel_schedule_length = length;
+	handle->channel_schedule_mask = channel_mask;
+	handle->channel_schedule_dirty = false;
+}
+
+static void update_channel_statistics(rfm95_handle_t *handle, uint8_t channel_index,
+                                      rfm95_channel_event_t event, const rfm95_downlink_metadata_t *metadata)
+{
+	rfm95_channel_statistics_t *statistics = &handle->channel_statistics[channel_index];
+	uint8_t previous_weight = channel_weight(statistics);
+
+	switch (event)
+	{
+		case RFM95_CHANNEL_EVENT_TX_SUCCESS:
+			if (statistics->tx_failures > 0) statistics->tx_failures--;
+			break;
+		case RFM95_CHANNEL_EVENT_TX_FAILURE:
+			if (statistics->tx_failures < RFM95_CHANNEL_WEIGHT_MAX) statistics->tx_failures++;
+			break;
+		case RFM95_CHANNEL_EVENT_ACK:
+			if (statistics->missed_acks > 0) statistics->missed_acks--;
+			break;
+		case RFM95_CHANNEL_EVENT_MISSED_ACK:
+			if (statistics->missed_acks < RFM95_CHANNEL_WEIGHT_MAX) statistics->missed_acks++;
+			break;
+		case RFM95_CHANNEL_EVENT_DOWNLINK:
+			// Exponentially weighted moving average of the down-link quality.
+			if (statistics->downlink_count == 0) {
+				statistics->rssi = metadata->rssi;
+				statistics->snr = metadata->snr;
+			} else {
+				statistics->rssi = (int16_t)((3 * statistics->rssi + metadata->rssi) / 4);
+				statistics->snr = (int8_t)((3 * statistics->snr + metadata->snr) / 4);
+			}
+			if (statistics->downlink_count < UINT16_MAX) statistics->downlink_count++;
+			break;
+		case RFM95_CHANNEL_EVENT_CAD_CLEAR:
+			if (statistics->cad_busy > 0) statistics->cad_busy--;
+			break;
+		case RFM95_CHANNEL_EVENT_CAD_BUSY:
+			if (statistics->cad_busy < RFM95_CHANNEL_WEIGHT_MAX) statistics->cad_busy++;
+			break;
+	}
+
+	// The schedule only needs to be rebuilt if the weight of the channel changed.
+	if (channel_weight(statistics) != previous_weight) {
+		handle->channel_schedule_dirty = true;
+	}
+}
+
+static bool select_channel(rfm95_handle_t *handle, uint16_t excluded_channel_mask, uint8_t *channel)
+{
+	// The duty cycle may not allow any channel for minutes, waiting is left to the application, which can plan with
+	// rfm95_get_next_tx_ticks.
+	if ((int32_t)(rfm95_get_next_tx_ticks(handle) - handle->get_precision_tick()) > 0) {
+		return false;
+	}
+
+	// Changing the data rate may change which channels are usable.
+	uint16_t usable_mask = usable_channel_mask(handle);
+
+	if (handle->channel_schedule_dirty || handle->channel_schedule_mask != usable_mask) {
+		rebuild_channel_schedule(handle, usable_mask);
+	}
+
+	uint32_t now_ticks = handle->get_precision_tick();
+
+	// Weighted random pick from the precomputed schedule, retried a few times for excluded or busy channels.
+	for (uint8_t attempt = 0; attempt < RFM95_CHANNEL_SELECT_ATTEMPTS; attempt++) {
+		uint8_t candidate = handle->channel_schedule[handle->random_int(handle->channel_schedule_length)];
+		if ((excluded_channel_mask & (1 << candidate)) == 0 &&
+		    is_sub_band_available(handle, channel_sub_band(handle, candidate), now_ticks)) {
+			*channel = candidate;
+			return true;
+		}
+	}
+
+	// Otherwise fall back to a uniform pick among the available channels.
+	uint16_t available_channel_mask = 0;
+
+	for (uint8_t i = 0; i < 16; i++) {
+		if ((usable_mask & (1 << i)) && is_sub_band_available(handle, channel_sub_band(handle, i), now_ticks)) {
+			available_channel_mask |= (1 << i);
+		}
+	}
+
+	if (available_channel_mask == 0) {
+		available_channel_mask = usable_mask;
+	}
+
+	uint16_t channel_mask = available_channel_mask & ~excluded_channel_mask;
+
+	// Fall back to all available channels if every channel is excluded.
+	if (channel_mask == 0) {
+		channel_mask = available_channel_mask;
+	}
+
+	uint8_t channel_count = 0;
+
+	for (uint8_t i = 0; i < 16; i++) {
+		if (channel_mask & (1 << i)) {
+			channel_count++;
+		}
+	}
+
+	uint8_t random_channel = handle->random_int(channel_count);
+
+	for (uint8_t i = 0; i < 16; i++) {
+		if (channel_mask & (1 << i)) {
+			if (random_channel == 0) {
+				*channel = i;
+				return true;
+			} else {
+				random_channel--;
+			}
+		}
+	}
+
+	*channel = 0;
+	return true;
+}
+
+static bool channel_activity_detection(rfm95_handle_t *handle, uint32_t symbol_time_us, bool *activity)
+{
+	// Enable cad-done interrupt, clear flags and previous interrupt time.
+	if (!write_register(handle, RFM95_REGISTER_DIO_MAPPING_1, RFM95_REGISTER_DIO_MAPPING_1_IRQ_FOR_CAD)) return false;
+	if (!write_register(handle, RFM95_REGISTER_IRQ_FLAGS, 0xff)) return false;
+	handle->interrupt_times[RFM95_INTERRUPT_DIO0] = 0;
+	handle->interrupt_times[RFM95_INTERRUPT_DIO1] = 0;
+	handle->interrupt_times[RFM95_INTERRUPT_DIO5] = 0;
+
+	// Move modem to lora standby.
+	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_STANDBY)) return false;
+
+	// Wait for the modem to be ready.
+	wait_for_irq(handle, RFM95_INTERRUPT_DIO5, RFM95_WAKEUP_TIMEOUT);
+
+	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_CAD)) return false;
+
+	// Channel activity detection takes about two symbols.
+	uint32_t cad_timeout = RFM95_WAKEUP_TIMEOUT + 4 * symbol_time_us / 1000;
+	if (!wait_for_irq(handle, RFM95_INTERRUPT_DIO0, cad_timeout)) return false;
+
+	uint8_t irq_flags;
+	if (!read_register(handle, RFM95_REGISTER_IRQ_FLAGS, &irq_flags, 1)) return false;
+	if (!write_register(handle, RFM95_REGISTER_IRQ_FLAGS, 0xff)) return false;
+
+	*activity = (irq_flags & RFM95_REGISTER_IRQ_FLAGS_CAD_DETECTED) != 0;
+
+	return true;
+}
+
+static bool detect_channel_activity(rfm95_handle_t *handle, uint8_t channel, bool *activity)
+{
+	// Configure channel and modem the same way as for the transmission.
+	if (!configure_channel(handle, channel)) return false;
+	if (!configure_modem(handle, handle->config.tx_data_rate, 0)) return false;
+
+	// Other up-links use non-inverted IQ.
+	if (!write_register(handle, RFM95_REGISTER_INVERT_IQ_1, RFM95_REGISTER_INVERT_IQ_1_TX)) return false;
+	if (!write_register(handle, RFM95_REGISTER_INVERT_IQ_2, RFM95_REGISTER_INVERT_IQ_2_TX)) return false;
+
+	if (!channel_activity_detection(handle, symbol_time_us(handle->config.tx_data_rate), activity)) return false;
+	handle->lbt_statistics.cad_count++;
+
+	return true;
+}
+
+static bool listen_before_talk(rfm95_handle_t *handle, uint8_t *channel)
+{
+	uint16_t busy_channel_mask = 0;
+
+	for (uint8_t attempt = 0; attempt < RFM95_LBT_MAX_ATTEMPTS; attempt++) {
+
+		bool activity;
+		if (!detect_channel_activity(handle, *channel, &activity)) return false;
+
+		update_channel_statistics(handle, *channel, activity ? RFM95_CHANNEL_EVENT_CAD_BUSY :
+		                                            RFM95_CHANNEL_EVENT_CAD_CLEAR, NULL);
+
+		if (!activity) {
+			return true;
+		}
+
+		handle->lbt_statistics.busy_count++;
+		busy_channel_mask |= (1 << *channel);
+
+		// Switch to another channel if one is available, otherwise back off for a random time.
+		uint8_t next_channel;
+
+		if (select_channel(handle, busy_channel_mask, &next_channel) &&
+		    (busy_channel_mask & (1 << next_channel)) == 0) {
+			*channel = next_channel;
+			handle->lbt_statistics.channel_switch_count++;
+
+		} else {
+			uint32_t backoff_ms = (1 + handle->random_int(RFM95_LBT_BACKOFF_SLOTS)) * RFM95_LBT_BACKOFF_SLOT_MS;
+			handle->precision_sleep_until(handle->get_precision_tick() +
+			                              backoff_ms * handle->precision_tick_frequency / 1000);
+			handle->lbt_statistics.backoff_count++;
+
+			// All channels may be tried again after backing off.
+			busy_channel_mask = 0;
+		}
+	}
+
+	// Transmit anyway rather than dropping the up-link.
+	handle->lbt_statistics.forced_tx_count++;
+
+	return true;
+}
+
+static bool fragment_bit(const uint8_t *bits, uint16_t index)
+{
+	return (bits[index / 8] >> (index % 8)) & 0x01;
+}
+
+static uint32_t fragment_prbs23(uint32_t x)
+{
+	uint32_t b0 = x & 0x01;
+	uint32_t b1 = (x & 0x20) >> 5;
+	return (x >> 1) + ((b0 ^ b1) << 22);
+}
+
+static void fragment_parity_row(uint16_t n, uint16_t fragment_count, uint8_t *row)
+{
+	memset(row, 0, (fragment_count + 7) / 8);
+
+	// Parity matrix line of the n-th coded fragment as defined by the LoRaWAN fragmented data block transport.
+	uint16_t power_of_two = (fragment_count & (fragment_count - 1)) == 0 ? 1 : 0;
+	uint32_t x = 1 + 1001 * (uint32_t)n;
+
+	for (uint16_t coefficients = 0; coefficients < fragment_count / 2; coefficients++) {
+		uint32_t r = fragment_count;
+		while (r >= fragment_count) {
+			x = fragment_prbs23(x);
+			r = x % (fragment_count + power_of_two);
+		}
+		row[r / 8] |= 1 << (r % 8);
+	}
+}
+
+static void fragment_xor(uint8_t *destination, const uint8_t *source, size_t length)
+{
+	for (size_t i = 0; i < length; i++) {
+		destination[i] ^= source[i];
+	}
+}
+
+static void fragment_xor_data(uint8_t *destination, const uint8_t *data, size_t data_length, uint16_t fragment,
+                              uint8_t fragment_size)
+{
+	// The last fragment is zero padded, which does not change the XOR.
+	size_t offset = (size_t)fragment * fragment_size;
+	size_t length = data_length - offset < fragment_size ? data_length - offset : fragment_size;
+	fragment_xor(destination, data + offset, length);
+}
+
+static uint16_t fragment_lost_rank(rfm95_fragmentation_session_t *session, uint16_t fragment)
+{
+	for (uint16_t rank = 0; rank < session->lost_count; rank++) {
+		if (session->lost_fragments[rank] == fragment) {
+			return rank;
+		}
+	}
+
+	return RFM95_FRAGMENT_LOST_MAX;
+}
+
+static void solve_fragments(rfm95_fragmentation_session_t *session)
+{
+	// The stored equations form a triangular matrix, back substitution leaves each lost fragment on its own.
+	for (int16_t rank = (int16_t)session->lost_count - 1; rank >= 0; rank--) {
+		uint8_t *data = session->buffer + session->lost_fragments[rank] * session->fragment_size;
+		for (uint16_t other = rank + 1; other < session->lost_count; other++) {
+			if (fragment_bit(session->matrix[rank], other)) {
+				fragment_xor(data, session->buffer + session->lost_fragments[other] * session->fragment_size,
+				             session->fragment_size);
+			}
+		}
+	}
+
+	session->complete = true;
+}
+
+static void process_fragment_equation(rfm95_fragmentation_session_t *session, uint8_t *row, uint8_t *data)
+{
+	// Eliminate the equation against the stored ones, ordered by their lowest unknown.
+	for (uint16_t rank = 0; rank < session->lost_count; rank++) {
+
+		if (!fragment_bit(row, rank)) {
+			continue;
+		}
+
+		uint8_t *stored_data = session->buffer + session->lost_fragments[rank] * session->fragment_size;
+
+		if (!fragment_bit(session->stored_rows, rank)) {
+
+			// New pivot, the equation is kept in place of the lost fragment it starts with.
+			memcpy(session->matrix[rank], row, sizeof(session->matrix[rank]));
+			memcpy(stored_data, data, session->fragment_size);
+			session->stored_rows[rank / 8] |= 1 << (rank % 8);
+			session->stored_row_count++;
+
+			if (session->stored_row_count == session->lost_count) {
+				solve_fragments(session);
+			}
+			return;
+		}
+
+		fragment_xor(row, session->matrix[rank], sizeof(session->matrix[rank]));
+		fragment_xor(data, stored_data, session->fragment_size);
+	}
+
+	// The equation did not add any information.
+}
+
+static void freeze_lost_fragments(rfm95_fragmentation_session_t *session)
+{
+	session->lost_count = 0;
+
+	for (uint16_t fragment = 0; fragment < session->fragment_count; fragment++) {
+		if (!fragment_bit(session->received, fragment)) {
+
+			// More losses than the equation matrix can hold make the block unrecoverable.
+			if (session->lost_count == RFM95_FRAGMENT_LOST_MAX) {
+				session->failed = true;
+				return;
+			}
+
+			session->lost_fragments[session->lost_count++] = fragment;
+		}
+	}
+
+	session->lost_frozen = true;
+
+	if (session->lost_count == 0) {
+		session->complete = true;
+	}
+}
+
+static void process_fragment_data(rfm95_fragmentation_session_t *session, uint16_t n, const uint8_t *fragment_data)
+{
+	if (n <= session->fragment_count && !session->lost_frozen) {
+
+		// Uncoded fragments are stored at their position in the block.
+		uint16_t fragment = n - 1;
+		if (!fragment_bit(session->received, fragment)) {
+			memcpy(session->buffer + fragment * session->fragment_size, fragment_data, session->fragment_size);
+			session->received[fragment / 8] |= 1 << (fragment % 8);
+			session->received_count++;
+		}
+
+		// Without losses the block is complete with the last uncoded fragment.
+		if (session->received_count == session->fragment_count) {
+			session->lost_frozen = true;
+			session->complete = true;
+		}
+		return;
+	}
+
+	// Fragments are sent in order, so fragments missing once a coded one arrives are lost.
+	if (!session->lost_frozen) {
+		freeze_lost_fragments(session);
+		if (session->complete || session->failed) {
+			return;
+		}
+	}
+
+	uint8_t row[RFM95_FRAGMENT_LOST_MAX / 8] = { 0 };
+	uint8_t data[RFM95_FRAGMENT_SIZE_MAX];
+	memcpy(data, fragment_data, session->fragment_size);
+
+	if (n <= session->fragment_count) {
+
+		// An uncoded fragment arriving late is an equation of its lost fragment only.
+		uint16_t rank = fragment_lost_rank(session, n - 1);
+		if (rank == RFM95_FRAGMENT_LOST_MAX) {
+			return;
+		}
+		row[rank / 8] |= 1 << (rank % 8);
+
+	} else {
+
+		// Coded fragments are reduced by the fragments already received to an equation of lost ones.
+		uint8_t parity_row[RFM95_FRAGMENT_COUNT_MAX / 8];
+		fragment_parity_row(n - session->fragment_count, session->fragment_count, parity_row);
+
+		for (uint16_t fragment = 0; fragment < session->fragment_count; fragment++) {
+			if (!fragment_bit(parity_row, fragment)) {
+				continue;
+			}
+			if (fragment_bit(session->received, fragment)) {
+				fragment_xor(data, session->buffer + fragment * session->fragment_size, session->fragment_size);
+			} else {
+				uint16_t rank = fragment_lost_rank(session, fragment);
+				row[rank / 8] |= 1 << (rank % 8);
+			}
+		}
+	}
+
+	process_fragment_equation(session, row, data);
+}
+
+static void process_fragment(rfm95_handle_t *handle, const uint8_t *payload, size_t payload_length)
+{
+	rfm95_fragmentation_session_t *session = &handle->fragmentation_session;
+
+	// DataFragment: CID, FragIndex in the upper 2 and fragment number N in the lower 14 bits, fragment data.
+	uint16_t index_and_n = payload[1] | (payload[2] << 8);
+	uint8_t fragment_index = index_and_n >> 14;
+	uint16_t n = index_and_n & 0x3fff;
+
+	if (fragment_index != session->fragment_index || session->complete || session->failed || n == 0 ||
+	    payload_length - 3 != session->fragment_size) {
+		return;
+	}
+
+	process_fragment_data(session, n, payload + 3);
+
+	if (session->complete && handle->on_fragmented_block != NULL) {
+		handle->on_fragmented_block(session->buffer, session->fragment_count * session->fragment_size);
+	}
+}
+
+static void deliver_downlink(rfm95_handle_t *handle, const rfm95_decoded_frame_t *frame,
+                             const rfm95_downlink_metadata_t *metadata)
+{
+	// Data fragments of an active fragmentation session are reassembled instead of being delivered.
+	if (frame->frame_port == RFM95_FRAGMENTATION_PORT && handle->fragmentation_session.buffer != NULL &&
+	    frame->frame_payload_length >= 3 && frame->frame_payload[0] == RFM95_FRAGMENT_DATA_FRAGMENT) {
+		process_fragment(handle, frame->frame_payload, frame->frame_payload_length);
+		return;
+	}
+
+	if (handle->on_downlink != NULL) {
+		handle->on_downlink(frame->frame_port, frame->frame_payload, frame->frame_payload_length, metadata);
+	}
+}
+
+static bool process_downlink(rfm95_handle_t *handle, uint8_t phy_payload_buf[RFM95_PHY_PAYLOAD_MAX_LENGTH],
+                             size_t phy_payload_len, const rfm95_downlink_metadata_t *metadata, bool *ack)
+{
+	rfm95_decoded_frame_t frame;
+
+	// Try decoding the frame payload, frames not meant for us are ignored.
+	if (!decode_phy_payload(handle, phy_payload_buf, phy_payload_len, &frame)) {
+		return true;
+	}
+
+	// Multicast frames only carry application payloads.
+	if (frame.multicast) {
+		rfm95_downlink_metadata_t multicast_metadata = *metadata;
+		multicast_metadata.multicast = true;
+		deliver_downlink(handle, &frame, &multicast_metadata);
+		return true;
+	}
+
+	*ack = frame.ack;
+	handle->frame_pending = frame.frame_pending;
+
+	// Confirmed down-links are acknowledged with the next up-link.
+	if (frame.confirmed) {
+		handle->pending_ack = true;
+	}
+
+	// Process Mac Commands
+	if (frame.mac_commands_length != 0) {
+
+		// Room for the answers behind those already queued.
+		uint8_t mac_response_data[RFM95_FRAME_OPTIONS_MAX_LENGTH + 51] = {0};
+		uint8_t mac_response_len = 0;
+
+		if (process_mac_commands(handle, frame.mac_commands, frame.mac_commands_length, mac_response_data,
+		                         &mac_response_len, metadata->snr) && mac_response_len != 0) {
+
+			size_t queued_length = handle->pending_mac_answers_length;
+			size_t max_payload_length = data_rate_configs[handle->config.tx_data_rate].max_payload_length;
+			uint8_t channel;
+
+			if (queued_length + mac_response_len <= RFM95_FRAME_OPTIONS_MAX_LENGTH) {
+
+				// Queue the answers behind those already waiting for the frame options of the next up-link.
+				memcpy(&handle->pending_mac_answers[queued_length], mac_response_data, mac_response_len);
+				handle->pending_mac_answers_length += mac_response_len;
+
+			} else if (mac_response_len <= max_payload_length && select_channel(handle, 0, &channel)) {
+
+				// Answers not fitting into the frame options require a separate port 0 up-link, which takes the
+				// already queued ones along if they fit. Commands are never split, answers not fitting at all or
+				// while the duty cycle allows no channel are dropped and the network repeats the requests.
+				if (queued_length + mac_response_len <= max_payload_length) {
+					memmove(&mac_response_data[queued_length], mac_response_data, mac_response_len);
+					memcpy(mac_response_data, handle->pending_mac_answers, queued_length);
+					mac_response_len += queued_length;
+					handle->pending_mac_answers_length = 0;
+				}
+
+				uint8_t answer_payload_buf[RFM95_PHY_PAYLOAD_MAX_LENGTH] = { 0 };
+				size_t answer_payload_len = encode_phy_payload(handle, answer_payload_buf, false, NULL, 0,
+				                                               mac_response_data, mac_response_len, 0);
+
+				// The frame counter is used up once encoded, whether or not the frame makes it on air.
+				handle->config.tx_frame_count++;
+
+				// The radio is taken over for the transmission, continuous reception is resumed by the caller.
+				if (!stop_continuous_receive(handle)) return false;
+
+				if (handle->listen_before_talk && !listen_before_talk(handle, &channel)) return false;
+
+				uint32_t tx_ticks;
+				if (!send_package(handle, answer_payload_buf, answer_payload_len, channel, &tx_ticks)) return false;
+
+				handle->pending_ack = false;
+			}
+		}
+	}
+
+	// Hand application payloads to the application, decrypted in place in the phy payload buffer.
+	if (frame.frame_payload_length != 0) {
+		deliver_downlink(handle, &frame, metadata);
+	}
+
+	return true;
+}
+
+static bool transmit_and_receive(rfm95_handle_t *handle, uint8_t *uplink_payload_buf, size_t uplink_payload_len,
+                                 uint8_t *selected_channel, uint32_t *tx_ticks, bool *ack)
+{
+	uint8_t phy_payload_buf[RFM95_PHY_PAYLOAD_MAX_LENGTH] = { 0 };
+	size_t phy_payload_len = 0;
+
+	// Listen before talk might switch to a channel without activity.
+	if (handle->listen_before_talk && !listen_before_talk(handle, selected_channel)) return false;
+
+	uint8_t channel = *selected_channel;
+
+	// Send the requested up-link.
+	if (!send_package(handle, uplink_payload_buf, uplink_payload_len, channel, tx_ticks)) {
+		update_channel_statistics(handle, channel, RFM95_CHANNEL_EVENT_TX_FAILURE, NULL);
+		return false;
+	}
+
+	update_channel_statistics(handle, channel, RFM95_CHANNEL_EVENT_TX_SUCCESS, NULL);
+
+	// Queued MAC command answers and acknowledgements have been delivered.
+	handle->pending_mac_answers_length = 0;
+	handle->pending_ack = false;
+
+	// Pending down-links are only known from the down-link following this up-link.
+	handle->frame_pending = false;
+
+	// Only receive if configured to do so.
+	if (handle->receive_mode == RFM95_RECEIVE_MODE_NONE) {
+		return true;
+	}
+
+	rfm95_downlink_metadata_t metadata;
+
+	// Try receiving a down-link.
+	if (!receive_package(handle, channel, *tx_ticks, phy_payload_buf, &phy_payload_len, &metadata)) return false;
+
+	// Any RX payload was received.
+	if (phy_payload_len != 0) {
+
+		// Down-links in RX1 are received on the up-link channel and tell about its quality.
+		if (metadata.rx_window == 1) {
+			update_channel_statistics(handle, channel, RFM95_CHANNEL_EVENT_DOWNLINK, &metadata);
+		}
+
+		if (!process_downlink(handle, phy_payload_buf, phy_payload_len, &metadata, ack)) return false;
+	}
+
+	return true;
+}
+
+static void request_link_check(rfm95_handle_t *handle, size_t send_data_length)
+{
+	rfm95_power_control_t *control = &handle->power_control;
+
+	control->link_check_pending = false;
+	control->link_check_answered = false;
+
+	// Without receive windows the answer could never arrive.
+	if (handle->power_control_interval == 0 || handle->receive_mode == RFM95_RECEIVE_MODE_NONE) {
+		return;
+	}
+
+	if (++control->uplinks_since_link_check < handle->power_control_interval) {
+		return;
+	}
+
+	// The request is postponed if it does not fit next to the payload and queued MAC command answers.
+	if (handle->pending_mac_answers_length + 1 > RFM95_FRAME_OPTIONS_MAX_LENGTH ||
+	    send_data_length + handle->pending_mac_answers_length + 1 >
+	    data_rate_configs[handle->config.tx_data_rate].max_payload_length) {
+		return;
+	}
+
+	handle->pending_mac_answers[handle->pending_mac_answers_length++] = 0x02; // LinkCheckReq
+	control->uplinks_since_link_check = 0;
+	control->link_check_pending = true;
+}
+
+static bool update_tx_power(rfm95_handle_t *handle)
+{
+	rfm95_power_control_t *control = &handle->power_control;
+
+	if (!control->link_check_pending) {
+		return true;
+	}
+
+	control->link_check_pending = false;
+
+	int8_t max_power = handle->power_control_max_power == 20 ? 20 : 17;
+	int16_t power = handle->tx_power;
+
+	if (!control->link_check_answered) {
+
+		// Repeatedly unanswered requests hint at up-links not reaching any gateway.
+		if (++control->missed_link_checks < RFM95_POWER_CONTROL_MISSED_MAX) {
+			return true;
+		}
+		power = max_power;
+
+	} else {
+
+		control->missed_link_checks = 0;
+
+		// The down-link SNR above the demodulation floor of the up-link spreading factor (-7.5dB at SF7 down to -20dB
+		// at SF12) guards against lowering the power on an asymmetric link.
+		int16_t demodulation_floor = (20 - 5 * data_rate_configs[handle->config.tx_data_rate].spreading_factor) / 2;
+		int16_t downlink_margin = control->snr - demodulation_floor;
+		int16_t margin = control->margin < downlink_margin ? control->margin : downlink_margin;
+
+		// Power is lowered gradually and raised by the whole deficit at once, margins within the hysteresis keep the
+		// current power.
+		if (margin > RFM95_POWER_CONTROL_MARGIN_TARGET + RFM95_POWER_CONTROL_HYSTERESIS) {
+			int16_t step = margin - RFM95_POWER_CONTROL_MARGIN_TARGET;
+			power -= step < RFM95_POWER_CONTROL_STEP_DOWN_MAX ? step : RFM95_POWER_CONTROL_STEP_DOWN_MAX;
+		} else if (margin < RFM95_POWER_CONTROL_MARGIN_TARGET - RFM95_POWER_CONTROL_HYSTERESIS) {
+			power += RFM95_POWER_CONTROL_MARGIN_TARGET - margin;
+		}
+	}
+
+	// The PA supports 2 to 17dBm and 20dBm, anything in between is rounded up.
+	if (power < RFM95_POWER_MIN) power = RFM95_POWER_MIN;
+	if (power > 17) power = max_power;
+
+	if (power == handle->tx_power) {
+		return true;
+	}
+
+	return rfm95_set_power(handle, (int8_t)power);
+}
+
+static bool uplink_cycle(rfm95_handle_t *handle, const uint8_t *send_data, size_t send_data_length, uint8_t port,
+                         bool confirmed)
+{
+	uint8_t uplink_payload_buf[RFM95_PHY_PAYLOAD_MAX_LENGTH] = { 0 };
+
+	// Confirmed up-links are pointless without receiving the acknowledgement.
+	assert(!confirmed || handle->receive_mode != RFM95_RECEIVE_MODE_NONE);
+
+	// MAC command answers exceeding even an empty frame at this data rate are dropped, the network repeats its
+	// requests. Answers not fitting next to the payload are sent in an empty up-link first.
+	if (handle->pending_mac_answers_length > data_rate_configs[handle->config.tx_data_rate].max_payload_length) {
+		handle->pending_mac_answers_length = 0;
+	}
+	while (handle->pending_mac_answers_length > 0 && send_data_length > rfm95_get_max_payload_length(handle)) {
+		if (!uplink_cycle(handle, NULL, 0, 0, false)) return false;
+	}
+
+	// Nothing is encoded while the duty cycle allows no channel, so the frame counter is not used up.
+	uint8_t random_channel;
+	if (!select_channel(handle, 0, &random_channel)) {
+		handle->duty_cycle_blocked = true;
+		return false;
+	}
+
+	// Periodically ask the network for the link margin to adjust the transmission power.
+	request_link_check(handle, send_data_length);
+
+	// Build the up-link phy payload, piggybacking queued MAC command answers in the frame options.
+	size_t uplink_payload_len = encode_phy_payload(handle, uplink_payload_buf, confirmed, handle->pending_mac_answers,
+	                                               handle->pending_mac_answers_length, send_data, send_data_length,
+	                                               port);
+
+	// Retransmissions reuse the frame encoded once here and thereby its frame counter. The counter is advanced before
+	// anything else is transmitted, MAC command answers sent from the receive windows get the next value.
+	handle->config.tx_frame_count++;
+
+	// Unconfirmed up-links are transmitted once, confirmed ones until acknowledged.
+	uint8_t transmissions = confirmed ? handle->config.nb_trans : 1;
+
+	uint32_t tx_ticks;
+	bool ack = false;
+
+	for (uint8_t transmission = 0; transmission < transmissions && !ack; transmission++) {
+
+		if (transmission != 0) {
+
+			// Retransmissions must happen after the RX2 window plus a random acknowledgement timeout.
+			uint32_t ack_timeout_ms = RFM95_ACK_TIMEOUT_MIN + handle->random_int(100) * (RFM95_ACK_TIMEOUT_RANDOM / 100);
+			handle->precision_sleep_until(tx_ticks + handle->precision_tick_frequency * (handle->config.rx1_delay + 1) +
+			                              ack_timeout_ms * handle->precision_tick_frequency / 1000);
+
+			// Use a different channel for each retransmission if possible. Retransmissions stop if the duty cycle
+			// allows none, the up-link then fails without acknowledgement.
+			if (!select_channel(handle, 1 << random_channel, &random_channel)) {
+				handle->duty_cycle_blocked = true;
+				break;
+			}
+		}
+
+		bool success = transmit_and_receive(handle, uplink_payload_buf, uplink_payload_len, &random_channel,
+		                                    &tx_ticks, &ack);
+
+		if (!success) {
+			write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_SLEEP);
+			persist_config(handle);
+			return false;
+		}
+
+		if (confirmed) {
+			update_channel_statistics(handle, random_channel,
+			                          ack ? RFM95_CHANNEL_EVENT_ACK : RFM95_CHANNEL_EVENT_MISSED_ACK, NULL);
+		}
+	}
+
+	// The LinkCheckAns is received in the windows of the up-link carrying the request.
+	if (!update_tx_power(handle)) return false;
+
+	// Drain down-links pending at the network by sending empty up-links, each opening new receive windows. Polling
+	// stops once the duty cycle allows no channel, frame_pending stays set for the application to poll later.
+	for (uint8_t poll = 0; poll < handle->frame_pending_max_polls && handle->frame_pending; poll++) {
+
+		if (!select_channel(handle, 0, &random_channel)) {
+			break;
+		}
+
+		uplink_payload_len = encode_phy_payload(handle, uplink_payload_buf, false, handle->pending_mac_answers,
+		                                        handle->pending_mac_answers_length, NULL, 0, 0);
+		handle->config.tx_frame_count++;
+
+		bool poll_ack = false;
+		bool success = transmit_and_receive(handle, uplink_payload_buf, uplink_payload_len, &random_channel,
+		                                    &tx_ticks, &poll_ack);
+
+		if (!success) {
+			write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_SLEEP);
+			persist_config(handle);
+			return false;
+		}
+	}
+
+	if (!persist_config(handle)) return false;
+
+	// Unconfirmed up-links are successful once sent, confirmed ones only when acknowledged.
+	return !confirmed || ack;
+}
+
+bool rfm95_add_multicast_session(rfm95_handle_t *handle, const uint8_t device_address[4],
+                                 const uint8_t network_session_key[16], const uint8_t application_session_key[16])
+{
+	uint32_t address = device_address_to_int(device_address);
+
+	if (handle->multicast_session_count >= RFM95_MULTICAST_SESSION_COUNT ||
+	    find_multicast_session(handle, address) != NULL) {
+		return false;
+	}
+
+	// Insert the session keeping the sessions sorted by device address.
+	uint8_t index = handle->multicast_session_count;
+	while (index > 0 && device_address_to_int(handle->multicast_sessions[index - 1].device_address) > address) {
+		handle->multicast_sessions[index] = handle->multicast_sessions[index - 1];
+		index--;
+	}
+
+	rfm95_multicast_session_t *session = &handle->multicast_sessions[index];
+	memcpy(session->device_address, device_address, 4);
+	session->rx_frame_count = 0;
+
+	// Expand the keys and derive the CMAC subkeys once instead of for every received frame.
+	AES_Expand_Key((uint8_t *)network_session_key, session->network_round_keys);
+	AES_Expand_Key((uint8_t *)application_session_key, session->application_round_keys);
+	memset(session->mic_subkey_1, 0x00, 16);
+	memset(session->mic_subkey_2, 0x00, 16);
+	Generate_Keys_Expanded(session->mic_subkey_1, session->mic_subkey_2, session->network_round_keys);
+
+	handle->multicast_session_count++;
+
+	return true;
+}
+
+bool rfm95_remove_multicast_session(rfm95_handle_t *handle, const uint8_t device_address[4])
+{
+	rfm95_multicast_session_t *session = find_multicast_session(handle, device_address_to_int(device_address));
+
+	if (session == NULL) {
+		return false;
+	}
+
+	uint8_t index = session - handle->multicast_sessions;
+	memmove(session, session + 1, (handle->multicast_session_count - index - 1) * sizeof(rfm95_multicast_session_t));
+	handle->multicast_session_count--;
+
+	return true;
+}
+
+bool rfm95_acquire_beacon(rfm95_handle_t *handle)
+{
+	assert(handle->ping_slot_periodicity <= RFM95_PING_SLOT_PERIODICITY_MAX);
+
+	rfm95_class_b_state_t *class_b = &handle->class_b;
+	class_b->beacon_locked = false;
+
+	// Listen continuously for up to one beacon period.
+	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_STANDBY)) return false;
+	if (!configure_beacon_modem(handle, 0)) return false;
+	if (!write_register(handle, RFM95_REGISTER_DIO_MAPPING_1, RFM95_REGISTER_DIO_MAPPING_1_IRQ_FOR_RXDONE)) return false;
+	if (!write_register(handle, RFM95_REGISTER_IRQ_FLAGS, 0xff)) return false;
+	if (!write_register(handle, RFM95_REGISTER_FIFO_ADDR_PTR, 0x00)) return false;
+	handle->interrupt_times[RFM95_INTERRUPT_DIO0] = 0;
+	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_RX_CONTINUOUS)) return false;
+
+	const rfm95_data_rate_config_t *dr = &data_rate_configs[RFM95_BEACON_DATA_RATE];
+	uint32_t beacon_ticks = us_to_ticks(handle, rfm95_time_on_air_us(dr->spreading_factor, dr->bandwidth, 1,
+	                                                                 RFM95_BEACON_PREAMBLE_LENGTH,
+	                                                                 RFM95_BEACON_LENGTH, true, false));
+	uint32_t timeout_ticks = handle->get_precision_tick() +
+	                         us_to_ticks(handle, (uint64_t)(RFM95_BEACON_PERIOD_S + 2) * 1000000);
+
+	while ((int32_t)(handle->get_precision_tick() - timeout_ticks) < 0) {
+
+		uint32_t rx_done_ticks = handle->interrupt_times[RFM95_INTERRUPT_DIO0];
+		if (rx_done_ticks == 0) {
+			continue;
+		}
+		handle->interrupt_times[RFM95_INTERRUPT_DIO0] = 0;
+
+		uint32_t beacon_time;
+		bool valid;
+		if (!read_beacon(handle, &beacon_time, &valid)) return false;
+
+		if (valid) {
+			// The beacon is transmitted at the start of the beacon period, the interrupt marks its end.
+			class_b->beacon_time = beacon_time;
+			class_b->beacon_ticks = rx_done_ticks - beacon_ticks;
+			class_b->beacons_missed = 0;
+			class_b->ping_offset = calculate_ping_offset(handle, beacon_time,
+			                                             1 << (5 + handle->ping_slot_periodicity));
+			class_b->next_ping_slot = 0;
+			class_b->beacon_locked = true;
+			break;
+		}
+	}
+
+	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_SLEEP)) return false;
+
+	// Announce the ping slot periodicity with the next up-link.
+	if (class_b->beacon_locked && handle->pending_mac_answers_length + 2 <= RFM95_FRAME_OPTIONS_MAX_LENGTH) {
+		handle->pending_mac_answers[handle->pending_mac_answers_length++] = 0x10; // PingSlotInfoReq
+		handle->pending_mac_answers[handle->pending_mac_answers_length++] = handle->ping_slot_periodicity;
+	}
+
+	return class_b->beacon_locked;
+}
+
+static bool is_schedulable(rfm95_handle_t *handle, uint32_t target_ticks)
+{
+	uint32_t lead_ticks = us_to_ticks(handle, (uint64_t)RFM95_CLASS_B_MIN_LEAD_TIME * 1000);
+	return (int32_t)(target_ticks - handle->get_precision_tick()) > (int32_t)lead_ticks;
+}
+
+static uint32_t ping_slot_start_ms(rfm95_handle_t *handle, uint16_t ping_slot)
+{
+	uint16_t ping_period = 1 << (5 + handle->ping_slot_periodicity);
+	return RFM95_BEACON_RESERVED_MS + (handle->class_b.ping_offset + ping_slot * ping_period) * RFM95_PING_SLOT_MS;
+}
+
+static bool track_beacon(rfm95_handle_t *handle)
+{
+	rfm95_class_b_state_t *class_b = &handle->class_b;
+
+	// Beacons which passed while the application was busy count as missed.
+	do {
+		class_b->beacon_time += RFM95_BEACON_PERIOD_S;
+		class_b->beacon_ticks += us_to_ticks(handle, (uint64_t)RFM95_BEACON_PERIOD_S * 1000000);
+		class_b->beacons_missed++;
+	} while (!is_schedulable(handle, class_b->beacon_ticks));
+
+	bool received;
+	if (!open_class_b_window(handle, class_b->beacon_ticks, RFM95_BEACON_DATA_RATE,
+	                         class_b->beacons_missed * RFM95_BEACON_PERIOD_S, true, &received)) return false;
+
+	if (received) {
+
+		uint32_t rx_done_ticks = handle->interrupt_times[RFM95_INTERRUPT_DIO0];
+
+		uint32_t beacon_time;
+		bool valid;
+		if (!read_beacon(handle, &beacon_time, &valid)) return false;
+		if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_SLEEP)) return false;
+
+		// Resynchronise to the received beacon.
+		if (valid) {
+			const rfm95_data_rate_config_t *dr = &data_rate_configs[RFM95_BEACON_DATA_RATE];
+			class_b->beacon_time = beacon_time;
+			class_b->beacon_ticks = rx_done_ticks - us_to_ticks(handle, rfm95_time_on_air_us(
+				dr->spreading_factor, dr->bandwidth, 1, RFM95_BEACON_PREAMBLE_LENGTH, RFM95_BEACON_LENGTH, true, false));
+			class_b->beacons_missed = 0;
+		}
+	}
+
+	// Without beacons the ping slots drift apart, give up after the maximum beacon-less operation time.
+	if (class_b->beacons_missed > RFM95_BEACONLESS_OPERATION_MAX) {
+		class_b->beacon_locked = false;
+		return false;
+	}
+
+	// The ping slot positions change with every beacon period.
+	class_b->ping_offset = calculate_ping_offset(handle, class_b->beacon_time, 1 << (5 + handle->ping_slot_periodicity));
+	class_b->next_ping_slot = 0;
+
+	return true;
+}
+
+static bool receive_ping_slot(rfm95_handle_t *handle)
+{
+	rfm95_class_b_state_t *class_b = &handle->class_b;
+
+	uint32_t slot_start_ms = ping_slot_start_ms(handle, class_b->next_ping_slot++);
+
+	bool received;
+	if (!open_class_b_window(handle, class_b->beacon_ticks + us_to_ticks(handle, (uint64_t)slot_start_ms * 1000),
+	                         class_b->ping_slot_data_rate,
+	                         class_b->beacons_missed * RFM95_BEACON_PERIOD_S + slot_start_ms / 1000 + 1, false,
+	                         &received)) return false;
+
+	if (!received) {
+		return true;
+	}
+
+	uint8_t phy_payload_buf[RFM95_PHY_PAYLOAD_MAX_LENGTH] = { 0 };
+	size_t phy_payload_len = 0;
+
+	rfm95_downlink_metadata_t metadata;
+	metadata.rx_window = 0;
+
+	if (!read_package(handle, phy_payload_buf, &phy_payload_len, &metadata)) return false;
+
+	if (phy_payload_len != 0) {
+
+		bool ack = false;
+		if (!process_downlink(handle, phy_payload_buf, phy_payload_len, &metadata, &ack)) return false;
+
+		if (!persist_config(handle)) return false;
+	}
+
+	return true;
+}
+
+bool rfm95_receive_class_b(rfm95_handle_t *handle)
+{
+	rfm95_class_b_state_t *class_b = &handle->class_b;
+
+	if (!class_b->beacon_locked) {
+		return false;
+	}
+
+	uint16_t ping_slot_count = 1 << (7 - handle->ping_slot_periodicity);
+
+	// Skip ping slots which passed while the application was busy.
+	while (class_b->next_ping_slot < ping_slot_count) {
+		uint32_t ping_slot_ms = ping_slot_start_ms(handle, class_b->next_ping_slot);
+		if (is_schedulable(handle, class_b->beacon_ticks + us_to_ticks(handle, (uint64_t)ping_slot_ms * 1000))) {
+			break;
+		}
+		class_b->next_ping_slot++;
+	}
+
+	if (class_b->next_ping_slot < ping_slot_count) {
+		return receive_ping_slot(handle);
+	}
+
+	return track_beacon(handle);
+}
+
+static bool send_receive_cycle(rfm95_handle_t *handle, const uint8_t *send_data, size_t send_data_length,
+                               uint8_t port, bool confirmed)
+{
+	// The point-to-point and FSK modes have to be stopped before using LoRaWAN.
+	assert(!handle->p2p_active && !handle->fsk_active);
+
+	handle->duty_cycle_blocked = false;
+
+	// Pause continuous reception while the radio is used for the up-link and its receive windows.
+	if (!stop_continuous_receive(handle)) return false;
+
+	bool success = uplink_cycle(handle, send_data, send_data_length, port, confirmed);
+
+	// After a fault the radio is brought back right away, which also resumes Class C reception.
+	if (handle->fault_pending) {
+		return rfm95_recover(handle) && success;
+	}
+
+	// Class C devices keep receiving on the RX2 parameters between up-links.
+	if (handle->receive_mode == RFM95_RECEIVE_MODE_CLASS_C && !start_continuous_receive(handle)) {
+		return false;
+	}
+
+	return success;
+}
+
+bool rfm95_process_downlinks(rfm95_handle_t *handle)
+{
+	bool success = true;
+
+	while (handle->rx_ring_tail != handle->rx_ring_head) {
+
+		// Copy the packet out of the ring so the slot can be reused by the interrupt handler right away.
+		uint8_t phy_payload_buf[RFM95_PHY_PAYLOAD_MAX_LENGTH];
+		rfm95_rx_packet_t *packet = &handle->rx_ring[handle->rx_ring_tail];
+		size_t phy_payload_len = packet->length;
+		rfm95_downlink_metadata_t metadata = packet->metadata;
+		memcpy(phy_payload_buf, packet->payload, phy_payload_len);
+
+		handle->rx_ring_tail = (handle->rx_ring_tail + 1) % RFM95_RX_RING_SIZE;
+
+		bool ack = false;
+		if (!process_downlink(handle, phy_payload_buf, phy_payload_len, &metadata, &ack)) {
+			success = false;
+			break;
+		}
+	}
+
+	// Resume continuous reception if answering MAC commands required the radio.
+	if (handle->receive_mode == RFM95_RECEIVE_MODE_CLASS_C && !handle->continuous_receive_active) {
+		if (!start_continuous_receive(handle)) return false;
+	}
+
+	if (!persist_config(handle)) return false;
+
+	return success;
+}
+
+static uint32_t p2p_symbol_time_us(const rfm95_p2p_config_t *config)
+{
+	return (uint32_t)(((uint64_t)1000000 << config->spreading_factor) / config->bandwidth);
+}
+
+static bool p2p_configure_modem(rfm95_handle_t *handle)
+{
+	const rfm95_p2p_config_t *config = &handle->p2p_config;
+
+	uint8_t modem_config_1 = (bandwidth_bits(config->bandwidth) << 4) | (config->coding_rate << 1);
+	uint8_t modem_config_2 = config->spreading_factor << 4;
+	uint8_t modem_config_3 = RFM95_REGISTER_MODEM_CONFIG_3_AGC_AUTO_ON;
+
+	if (config->implicit_header) {
+		modem_config_1 |= RFM95_REGISTER_MODEM_CONFIG_1_IMPLICIT_HEADER;
+	}
+	if (config->crc) {
+		modem_config_2 |= RFM95_REGISTER_MODEM_CONFIG_2_RX_PAYLOAD_CRC_ON;
+	}
+
+	// Low data rate optimization is mandated for symbol times above 16ms.
+	if (p2p_symbol_time_us(config) > 16000) {
+		modem_config_3 |= RFM95_REGISTER_MODEM_CONFIG_3_LOW_DATA_RATE_OPTIMIZE;
+	}
+
+	if (!configure_frequency(handle, config->frequency)) return false;
+	if (!write_register(handle, RFM95_REGISTER_MODEM_CONFIG_1, modem_config_1)) return false;
+	if (!write_register(handle, RFM95_REGISTER_MODEM_CONFIG_2, modem_config_2)) return false;
+	if (!write_register(handle, RFM95_REGISTER_MODEM_CONFIG_3, modem_config_3)) return false;
+	if (!write_register(handle, RFM95_REGISTER_PREAMBLE_MSB, (uint8_t)(config->preamble_length >> 8))) return false;
+	if (!write_register(handle, RFM95_REGISTER_PREAMBLE_LSB, (uint8_t)config->preamble_length)) return false;
+	if (!write_register(handle, RFM95_REGISTER_SYNC_WORD, config->sync_word)) return false;
+
+	// SF6 needs its own detection settings.
+	bool sf6 = config->spreading_factor == 6;
+	if (!write_register(handle, RFM95_REGISTER_DETECTION_OPTIMIZE,
+	                    sf6 ? RFM95_REGISTER_DETECTION_OPTIMIZE_SF6 : RFM95_REGISTER_DETECTION_OPTIMIZE_SF7_TO_SF12)) {
+		return false;
+	}
+	if (!write_register(handle, RFM95_REGISTER_DETECTION_THRESHOLD,
+	                    sf6 ? RFM95_REGISTER_DETECTION_THRESHOLD_SF6 : RFM95_REGISTER_DETECTION_THRESHOLD_SF7_TO_SF12)) {
+		return false;
+	}
+
+	// In implicit header mode the receiver takes the length from the payload length register.
+	if (config->implicit_header && !write_register(handle, RFM95_REGISTER_PAYLOAD_LENGTH, config->payload_length)) {
+		return false;
+	}
 
-				index += 1;
-				break;
-			}
-			case 0x05: // RXParamSetupReq
-			{
-				if ((index + 4) >= frame_payload_length) return false;
-				if ((answer_index + 2) >= 51) return false;
+	// Both ends use non-inverted IQ, unlike LoRaWAN down-links.
+	if (!write_register(handle, RFM95_REGISTER_INVERT_IQ_1, RFM95_REGISTER_INVERT_IQ_1_TX)) return false;
+	if (!write_register(handle, RFM95_REGISTER_INVERT_IQ_2, RFM95_REGISTER_INVERT_IQ_2_TX)) return false;
 
-				uint8_t dl_settings = frame_payload[index++];
-				uint8_t frequency_lsb = frame_payload[index++];
-				uint8_t frequency_msb = frame_payload[index++];
-				uint8_t frequency_hsb = frame_payload[index++];
-				uint32_t frequency = (frequency_lsb | (frequency_msb << 8) | (frequency_hsb << 16)) * 100;
+	return true;
+}
 
-				answer_buffer[answer_index++] = 0x05;
-				answer_buffer[answer_index++] = 0b0000111;
-				break;
-			}
-			case 0x06: // DevStatusReq
-			{
-				if ((answer_index + 3) >= 51) return false;
+static bool p2p_start_continuous_receive(rfm95_handle_t *handle)
+{
+	if (!write_register(handle, RFM95_REGISTER_DIO_MAPPING_1, RFM95_REGISTER_DIO_MAPPING_1_IRQ_FOR_RXDONE)) return false;
+	if (!write_register(handle, RFM95_REGISTER_IRQ_FLAGS, 0xff)) return false;
+	if (!write_register(handle, RFM95_REGISTER_FIFO_ADDR_PTR, 0x00)) return false;
 
-				uint8_t margin = (uint8_t)(snr & 0x1f);
-				uint8_t battery_level = handle->get_battery_level == NULL ? 0xff : handle->get_battery_level();
+	// The interrupt handler reads packets into the receive ring from now on.
+	handle->continuous_receive_active = true;
 
-				answer_buffer[answer_index++] = 0x06;
-				answer_buffer[answer_index++] = battery_level;
-				answer_buffer[answer_index++] = margin;
-				break;
-			}
-			case 0x07: // NewChannelReq
-			{
-				if ((index + 4) >= frame_payload_length) return false;
-				if ((answer_index + 2) >= 51) return false;
+	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_RX_CONTINUOUS)) {
+		handle->continuous_receive_active = false;
+		return false;
+	}
 
-				uint8_t channel_index = frame_payload[index++];
-				uint8_t frequency_lsb = frame_payload[index++];
-				uint8_t frequency_msb = frame_payload[index++];
-				uint8_t frequency_hsb = frame_payload[index++];
-				uint8_t min_max_dr = frame_payload[index++];
+	return true;
+}
 
-				uint32_t frequency = (frequency_lsb | (frequency_msb << 8) | (frequency_hsb << 16)) * 100;
-				uint8_t min_dr = min_max_dr & 0x0f;
-				uint8_t max_dr = (min_max_dr >> 4) & 0x0f;
+static bool p2p_transmit_next(rfm95_handle_t *handle)
+{
+	// Once the queue is drained the radio returns to reception or stays in standby, which it enters after TxDone.
+	if (handle->p2p_tx_tail == handle->p2p_tx_head) {
+		handle->p2p_transmitting = false;
+		return handle->p2p_receive ? p2p_start_continuous_receive(handle) : true;
+	}
 
-				if (channel_index >= 3) {
-					config_set_channel(handle, channel_index, frequency);
-				}
+	rfm95_p2p_tx_packet_t *packet = &handle->p2p_tx_queue[handle->p2p_tx_tail];
 
-				bool dr_supports_125kHz_SF7 = min_dr <= 5 || max_dr >= 5;
+	if (!handle->p2p_config.implicit_header &&
+	    !write_register(handle, RFM95_REGISTER_PAYLOAD_LENGTH, packet->length)) {
+		return false;
+	}
 
-				answer_buffer[answer_index++] = 0x07;
-				answer_buffer[answer_index++] = 0x01 | (dr_supports_125kHz_SF7 << 1);
-				break;
-			}
-			case 0x08: // RXTimingSetupReq
-			{
-				if (index >= frame_payload_length) return false;
-				if ((answer_index + 2) >= 51) return false;
+	if (!write_register(handle, RFM95_REGISTER_DIO_MAPPING_1, RFM95_REGISTER_DIO_MAPPING_1_IRQ_FOR_TXDONE)) return false;
+	if (!write_register(handle, RFM95_REGISTER_IRQ_FLAGS, 0xff)) return false;
+	if (!write_register(handle, RFM95_REGISTER_FIFO_ADDR_PTR, 0x00)) return false;
+	if (!write_registers(handle, RFM95_REGISTER_FIFO_ACCESS, packet->payload, packet->length)) return false;
 
-				handle->config.rx1_delay = frame_payload[index++] & 0xf;
-				if (handle->config.rx1_delay == 0) {
-					handle->config.rx1_delay = 1;
-				}
+	// The slot is free once its payload is in the FIFO.
+	handle->p2p_tx_tail = (handle->p2p_tx_tail + 1) % RFM95_P2P_TX_QUEUE_SIZE;
 
-				answer_buffer[answer_index++] = 0x08;
-				break;
-			}
-			case 0x09: // TxParamSetupReq
-			{
-				if (index >= frame_payload_length) return false;
+	return write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_TX);
+}
 
-				break;
-			}
-			case 0x0a: // DlChannelReq
-			{
-				if ((index + 4) >= frame_payload_length) return false;
+bool rfm95_p2p_start(rfm95_handle_t *handle, const rfm95_p2p_config_t *config)
+{
+	assert(config->spreading_factor >= 6 && config->spreading_factor <= 12);
+	assert(config->spreading_factor != 6 || config->implicit_header);
+	assert(config->coding_rate >= 1 && config->coding_rate <= 4);
+	assert(config->preamble_length >= 6);
+	assert(!config->implicit_header || config->payload_length != 0);
+	assert(!handle->fsk_active);
+
+	// Class C reception is paused while the point-to-point mode owns the radio.
+	if (!stop_continuous_receive(handle)) return false;
+	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_STANDBY)) return false;
 
-				break;
-			}
-			case 0x0b: // RekeyConf
-			{
-				if (index >= frame_payload_length) return false;
+	handle->p2p_config = *config;
+	handle->p2p_receive = false;
+	handle->p2p_transmitting = false;
+	handle->p2p_tx_head = 0;
+	handle->p2p_tx_tail = 0;
+	handle->rx_ring_head = 0;
+	handle->rx_ring_tail = 0;
 
-				break;
+	if (!p2p_configure_modem(handle)) return false;
+
+	handle->p2p_active = true;
+	return true;
+}
+
+bool rfm95_p2p_start_receive(rfm95_handle_t *handle)
+{
+	assert(handle->p2p_active);
+
+	handle->p2p_receive = true;
+
+	// Reception starts once queued packets have been sent.
+	if (handle->p2p_transmitting || handle->continuous_receive_active) {
+		return true;
+	}
+
+	return p2p_start_continuous_receive(handle);
+}
+
+bool rfm95_p2p_send(rfm95_handle_t *handle, const uint8_t *payload, size_t payload_length)
+{
+	assert(handle->p2p_active);
+	assert(payload_length != 0 && payload_length <= RFM95_PHY_PAYLOAD_MAX_LENGTH);
+	assert(!handle->p2p_config.implicit_header || payload_length == handle->p2p_config.payload_length);
+
+	uint8_t head = handle->p2p_tx_head;
+	uint8_t next_head = (head + 1) % RFM95_P2P_TX_QUEUE_SIZE;
+
+	// The caller retries once the interrupt handler has loaded the next packet into the FIFO.
+	if (next_head == handle->p2p_tx_tail) {
+		return false;
+	}
+
+	memcpy(handle->p2p_tx_queue[head].payload, payload, payload_length);
+	handle->p2p_tx_queue[head].length = (uint8_t)payload_length;
+	handle->p2p_tx_head = next_head;
+
+	// While a packet is on air the interrupt handler sends the queued packets back to back, otherwise the transmission
+	// is started here. The interrupt handler can not interfere as TxDone is only signalled while transmitting.
+	if (handle->p2p_transmitting) {
+		return true;
+	}
+
+	// Stop the interrupt handler from reading packets before leaving reception.
+	handle->continuous_receive_active = false;
+	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_STANDBY)) return false;
+
+	handle->p2p_transmitting = true;
+
+	if (!p2p_transmit_next(handle)) {
+		handle->p2p_transmitting = false;
+		return false;
+	}
+
+	return true;
+}
+
+bool rfm95_p2p_receive(rfm95_handle_t *handle, rfm95_rx_packet_t *packet)
+{
+	if (handle->rx_ring_tail == handle->rx_ring_head) {
+		return false;
+	}
+
+	*packet = handle->rx_ring[handle->rx_ring_tail];
+	handle->rx_ring_tail = (handle->rx_ring_tail + 1) % RFM95_RX_RING_SIZE;
+
+	return true;
+}
+
+uint32_t rfm95_wake_on_radio_interval_ms(const rfm95_p2p_config_t *config, uint32_t max_latency_ms,
+                                         uint16_t rx_duty_permille)
+{
+	assert(rx_duty_permille > 0 && rx_duty_permille <= 1000);
+
+	// Each sniff costs a channel activity detection of about two symbols at roughly the receive current. The shortest
+	// interval keeping that within the budget gives the lowest latency and the shortest sender preamble.
+	uint32_t cad_time_us = 2 * p2p_symbol_time_us(config);
+	uint32_t interval_ms = (cad_time_us + rx_duty_permille - 1) / rx_duty_permille;
+
+	// Latency and power budget can not both be met.
+	if (interval_ms > max_latency_ms) {
+		return 0;
+	}
+
+	return interval_ms;
+}
+
+uint16_t rfm95_wake_on_radio_preamble_length(const rfm95_p2p_config_t *config, uint32_t sniff_interval_ms)
+{
+	// The preamble has to span a whole sniff interval plus the detection itself, so a sniff always falls into it.
+	uint32_t symbol_time_us = p2p_symbol_time_us(config);
+	uint64_t symbols = ((uint64_t)sniff_interval_ms * 1000 + 4 * symbol_time_us) / symbol_time_us + 1;
+
+	return symbols > UINT16_MAX ? UINT16_MAX : (uint16_t)symbols;
+}
+
+bool rfm95_p2p_wake_on_radio(rfm95_handle_t *handle, uint32_t sniff_interval_ms, uint32_t timeout_ms)
+{
+	const rfm95_p2p_config_t *config = &handle->p2p_config;
+
+	assert(handle->p2p_active && !handle->p2p_transmitting);
+
+	// Packets are read right here instead of by the interrupt handler.
+	handle->continuous_receive_active = false;
+
+	uint32_t symbol_time_us = p2p_symbol_time_us(config);
+	uint8_t rx_head = handle->rx_ring_head;
+
+	// A detected preamble can last up to a whole sniff interval before the packet follows.
+	uint32_t rx_timeout_ms = RFM95_RECEIVE_TIMEOUT + sniff_interval_ms +
+	                         rfm95_time_on_air_us(config->spreading_factor, config->bandwidth, config->coding_rate,
+	                                              config->preamble_length,
+	                                              config->implicit_header ? config->payload_length : 255,
+	                                              config->implicit_header, config->crc) / 1000;
+
+	uint32_t interval_ticks = (uint32_t)((uint64_t)sniff_interval_ms * handle->precision_tick_frequency / 1000);
+	uint32_t sniff_ticks = handle->get_precision_tick();
+	uint32_t end_ticks = sniff_ticks + (uint32_t)((uint64_t)timeout_ms * handle->precision_tick_frequency / 1000);
+
+	while ((int32_t)(end_ticks - sniff_ticks) > 0 && handle->rx_ring_head == rx_head) {
+
+		bool activity;
+		if (!channel_activity_detection(handle, symbol_time_us, &activity)) return false;
+		handle->wake_on_radio_statistics.sniff_count++;
+
+		if (activity) {
+
+			// Receive with a short symbol timeout, the preamble already on air is locked onto right away and false
+			// detections end quickly.
+			if (!write_register(handle, RFM95_REGISTER_SYMB_TIMEOUT_LSB, RFM95_WAKE_ON_RADIO_RX_SYMBOLS)) return false;
+			if (!write_register(handle, RFM95_REGISTER_DIO_MAPPING_1, RFM95_REGISTER_DIO_MAPPING_1_IRQ_FOR_RXDONE)) {
+				return false;
+			}
+			if (!write_register(handle, RFM95_REGISTER_FIFO_ADDR_PTR, 0x00)) return false;
+			handle->interrupt_times[RFM95_INTERRUPT_DIO0] = 0;
+			handle->interrupt_times[RFM95_INTERRUPT_DIO1] = 0;
+			if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_RX_SINGLE)) return false;
+
+			// The packet goes into the receive ring, as in continuous reception.
+			if (wait_for_rx_irqs(handle, rx_timeout_ms) && handle->interrupt_times[RFM95_INTERRUPT_DIO0] != 0) {
+				receive_continuous_packet(handle);
 			}
-			case 0x0c: // ADRParamSetupReq
-			{
-				if (index >= frame_payload_length) return false;
 
-				break;
+			if (handle->rx_ring_head == rx_head) {
+				handle->wake_on_radio_statistics.false_wakeup_count++;
 			}
-			case 0x0d: // DeviceTimeReq
-			{
-				break;
+		}
+
+		// The radio sleeps until the next sniff.
+		if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_SLEEP)) return false;
+
+		sniff_ticks += interval_ticks;
+		if ((int32_t)(sniff_ticks - handle->get_precision_tick()) > 0 && handle->rx_ring_head == rx_head) {
+			handle->precision_sleep_until(sniff_ticks);
+		}
+	}
+
+	return true;
+}
+
+bool rfm95_p2p_stop(rfm95_handle_t *handle)
+{
+	if (!handle->p2p_active) {
+		return true;
+	}
+
+	// Stop the interrupt handler from accessing the radio, queued packets are discarded.
+	handle->p2p_active = false;
+	handle->p2p_transmitting = false;
+	handle->continuous_receive_active = false;
+	handle->p2p_tx_tail = handle->p2p_tx_head;
+
+	// Restore the LoRaWAN settings not covered by configure_modem.
+	if (!configure_lora(handle)) return false;
+
+	// Class C devices resume reception on the RX2 parameters.
+	if (handle->receive_mode == RFM95_RECEIVE_MODE_CLASS_C) {
+		return start_continuous_receive(handle);
+	}
+
+	return true;
+}
+
+static uint8_t fsk_rx_bandwidth_bits(uint32_t bandwidth)
+{
+	static const uint8_t mantissas[] = { 24, 20, 16 };
+
+	// RxBw = FXOSC / (mantissa * 2^(exponent + 2)), the narrowest bandwidth at least as wide as requested is used.
+	for (int8_t exponent = 7; exponent >= 1; exponent--) {
+		for (uint8_t i = 0; i < sizeof(mantissas); i++) {
+			if (32000000 / ((uint32_t)mantissas[i] << (exponent + 2)) >= bandwidth) {
+				return ((2 - i) << 3) | exponent;
 			}
 		}
 	}
 
-	*answer_buffer_length = answer_index;
+	// 250kHz is the widest bandwidth.
+	return 0x01;
+}
+
+static uint32_t fsk_time_on_air_ms(const rfm95_fsk_config_t *config, size_t data_length)
+{
+	size_t length = config->preamble_length + config->sync_word_length + (config->fixed_length == 0 ? 1 : 0) +
+	                data_length + (config->crc ? 2 : 0);
+	return (uint32_t)((uint64_t)length * 8 * 1000 / config->bitrate) + 1;
+}
+
+static bool fsk_configure(rfm95_handle_t *handle)
+{
+	const rfm95_fsk_config_t *config = &handle->fsk_config;
+
+	// Bit rate = FXOSC / register value, frequency deviation = register value * FSTEP.
+	uint16_t bitrate = (uint16_t)(32000000 / config->bitrate);
+	uint16_t deviation = (uint16_t)RFM95_FRF(config->frequency_deviation);
+	uint8_t rx_bandwidth = fsk_rx_bandwidth_bits(config->rx_bandwidth);
+
+	if (!configure_frequency(handle, config->frequency)) return false;
+	if (!write_register(handle, RFM95_REGISTER_FSK_BITRATE_MSB, (uint8_t)(bitrate >> 8))) return false;
+	if (!write_register(handle, RFM95_REGISTER_FSK_BITRATE_LSB, (uint8_t)bitrate)) return false;
+	if (!write_register(handle, RFM95_REGISTER_FSK_FDEV_MSB, (uint8_t)(deviation >> 8))) return false;
+	if (!write_register(handle, RFM95_REGISTER_FSK_FDEV_LSB, (uint8_t)deviation)) return false;
+	if (!write_register(handle, RFM95_REGISTER_PA_RAMP,
+	                    config->gaussian ? RFM95_REGISTER_PA_RAMP_GAUSSIAN_BT_0_5 : RFM95_REGISTER_PA_RAMP_NO_SHAPING)) {
+		return false;
+	}
+	if (!write_register(handle, RFM95_REGISTER_FSK_RX_BW, rx_bandwidth)) return false;
+	if (!write_register(handle, RFM95_REGISTER_FSK_AFC_BW, rx_bandwidth)) return false;
+
+	// Reception is triggered by a preamble of at least two bytes, with automatic gain control.
+	if (!write_register(handle, RFM95_REGISTER_FSK_RX_CONFIG, RFM95_REGISTER_FSK_RX_CONFIG_DEFAULT)) return false;
+	if (!write_register(handle, RFM95_REGISTER_FSK_PREAMBLE_DETECT, RFM95_REGISTER_FSK_PREAMBLE_DETECT_2_BYTES)) {
+		return false;
+	}
+	if (!write_register(handle, RFM95_REGISTER_FSK_PREAMBLE_MSB, (uint8_t)(config->preamble_length >> 8))) return false;
+	if (!write_register(handle, RFM95_REGISTER_FSK_PREAMBLE_LSB, (uint8_t)config->preamble_length)) return false;
+
+	// Reception restarts automatically after each packet, only packets with a matching sync word are received.
+	if (!write_register(handle, RFM95_REGISTER_FSK_SYNC_CONFIG,
+	                    RFM95_REGISTER_FSK_SYNC_CONFIG_AUTO_RESTART_SYNC_ON | (config->sync_word_length - 1))) {
+		return false;
+	}
+	if (!write_registers(handle, RFM95_REGISTER_FSK_SYNC_VALUE_1, config->sync_word, config->sync_word_length)) {
+		return false;
+	}
+
+	// Packets failing the CRC are still reported, so the bytes already drained from the FIFO can be discarded.
+	uint8_t packet_config_1 = RFM95_REGISTER_FSK_PACKET_CONFIG_1_CRC_AUTO_CLEAR_OFF;
+	if (config->fixed_length == 0) packet_config_1 |= RFM95_REGISTER_FSK_PACKET_CONFIG_1_VARIABLE_LENGTH;
+	if (config->whitening) packet_config_1 |= RFM95_REGISTER_FSK_PACKET_CONFIG_1_WHITENING;
+	if (config->crc) packet_config_1 |= RFM95_REGISTER_FSK_PACKET_CONFIG_1_CRC_ON;
+
+	uint16_t payload_length = config->fixed_length != 0 ? config->fixed_length : 255;
+
+	if (!write_register(handle, RFM95_REGISTER_FSK_PACKET_CONFIG_1, packet_config_1)) return false;
+	if (!write_register(handle, RFM95_REGISTER_FSK_PACKET_CONFIG_2,
+	                    RFM95_REGISTER_FSK_PACKET_CONFIG_2_PACKET_MODE | ((payload_length >> 8) & 0x07))) {
+		return false;
+	}
+	if (!write_register(handle, RFM95_REGISTER_FSK_PAYLOAD_LENGTH, (uint8_t)payload_length)) return false;
+
+	// DIO0 signals PacketSent and PayloadReady, DIO1 the FIFO level.
+	if (!write_register(handle, RFM95_REGISTER_DIO_MAPPING_1, RFM95_REGISTER_DIO_MAPPING_1_FSK_PACKET)) return false;
+
 	return true;
 }
 
-static bool receive_at_scheduled_time(rfm95_handle_t *handle, uint32_t scheduled_time)
+static bool fsk_read_fifo(rfm95_handle_t *handle, uint8_t *buffer, size_t buffer_size, size_t *received,
+                          size_t *expected, size_t available, bool *valid)
 {
-	// Sleep until 1ms before the scheduled time.
-	handle->precision_sleep_until(scheduled_time - handle->precision_tick_frequency / 1000);
+	// Variable length packets start with their length.
+	if (*expected == 0) {
+		uint8_t length_byte;
+		if (!read_register(handle, RFM95_REGISTER_FIFO_ACCESS, &length_byte, 1)) return false;
+		*expected = length_byte;
+		available--;
+	}
 
-	// Clear flags and previous interrupt time, configure mapping for RX done.
-	if (!write_register(handle, RFM95_REGISTER_DIO_MAPPING_1, RFM95_REGISTER_DIO_MAPPING_1_IRQ_FOR_RXDONE)) return false;
-	if (!write_register(handle, RFM95_REGISTER_IRQ_FLAGS, 0xff)) return false;
+	if (*expected == 0 || *expected > buffer_size) {
+		*valid = false;
+		return true;
+	}
+
+	size_t count = *expected - *received < available ? *expected - *received : available;
+	if (count != 0 && !read_register(handle, RFM95_REGISTER_FIFO_ACCESS, buffer + *received, count)) return false;
+	*received += count;
+
+	return true;
+}
+
+static bool fsk_restart_receive(rfm95_handle_t *handle)
+{
+	// Setting the overrun flag clears the FIFO.
+	if (!write_register(handle, RFM95_REGISTER_FSK_IRQ_FLAGS_2, RFM95_REGISTER_FSK_IRQ_FLAGS_2_FIFO_OVERRUN)) return false;
+	return write_register(handle, RFM95_REGISTER_FSK_RX_CONFIG,
+	                      RFM95_REGISTER_FSK_RX_CONFIG_DEFAULT | RFM95_REGISTER_FSK_RX_CONFIG_RESTART);
+}
+
+bool rfm95_fsk_start(rfm95_handle_t *handle, const rfm95_fsk_config_t *config)
+{
+	assert(config->bitrate >= 1200 && config->bitrate <= 300000);
+	assert(config->frequency_deviation + config->bitrate / 2 <= 250000);
+	assert(config->sync_word_length >= 1 && config->sync_word_length <= 8);
+	assert(config->fixed_length <= 2047);
+	assert(!handle->p2p_active);
+
+	// Class C reception is paused while the FSK modem is used.
+	if (!stop_continuous_receive(handle)) return false;
+
+	// The modem can only be switched in sleep mode.
+	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_SLEEP)) return false;
+	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_SLEEP)) return false;
+
+	handle->fsk_config = *config;
+
+	if (!fsk_configure(handle)) return false;
+
+	handle->fsk_active = true;
+	return true;
+}
+
+bool rfm95_fsk_send(rfm95_handle_t *handle, const uint8_t *data, size_t data_length)
+{
+	const rfm95_fsk_config_t *config = &handle->fsk_config;
+
+	assert(handle->fsk_active);
+	assert(data_length != 0);
+	assert(config->fixed_length == 0 ? data_length <= 255 : data_length == config->fixed_length);
+
+	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_FSK_STANDBY)) return false;
+
+	// Transmission starts once the FIFO holds data, so it is filled before switching to TX mode.
+	if (!write_register(handle, RFM95_REGISTER_FSK_FIFO_THRESH,
+	                    RFM95_REGISTER_FSK_FIFO_THRESH_TX_START_NOT_EMPTY | RFM95_FSK_FIFO_THRESHOLD)) {
+		return false;
+	}
 	handle->interrupt_times[RFM95_INTERRUPT_DIO0] = 0;
-	handle->interrupt_times[RFM95_INTERRUPT_DIO1] = 0;
-	handle->interrupt_times[RFM95_INTERRUPT_DIO5] = 0;
 
-	// Move modem to lora standby.
-	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_STANDBY)) return false;
+	if (config->fixed_length == 0) {
+		uint8_t length_byte = (uint8_t)data_length;
+		if (!write_registers(handle, RFM95_REGISTER_FIFO_ACCESS, &length_byte, 1)) return false;
+	}
 
-	// Wait for the modem to be ready.
-	wait_for_irq(handle, RFM95_INTERRUPT_DIO5, RFM95_WAKEUP_TIMEOUT);
+	size_t written = data_length < RFM95_FSK_FIFO_SIZE - 1 ? data_length : RFM95_FSK_FIFO_SIZE - 1;
+	if (!write_registers(handle, RFM95_REGISTER_FIFO_ACCESS, data, written)) return false;
+
+	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_FSK_TX)) return false;
+
+	uint32_t time_on_air_ms = fsk_time_on_air_ms(config, data_length);
+	uint32_t timeout_tick = handle->get_precision_tick() +
+	                        (uint32_t)((uint64_t)(RFM95_SEND_TIMEOUT + time_on_air_ms) *
+	                                   handle->precision_tick_frequency / 1000);
+
+	// Packets longer than the FIFO are refilled whenever the FIFO level drops to the threshold. The FIFO level
+	// interrupt only signals the FIFO filling up, so the flag is polled while transmitting.
+	while (written < data_length) {
+
+		uint8_t irq_flags;
+		if (!read_register(handle, RFM95_REGISTER_FSK_IRQ_FLAGS_2, &irq_flags, 1)) return false;
+
+		if ((irq_flags & RFM95_REGISTER_FSK_IRQ_FLAGS_2_FIFO_LEVEL) == 0) {
+			size_t count = data_length - written;
+			if (count > RFM95_FSK_FIFO_SIZE - RFM95_FSK_FIFO_THRESHOLD) {
+				count = RFM95_FSK_FIFO_SIZE - RFM95_FSK_FIFO_THRESHOLD;
+			}
+			if (!write_registers(handle, RFM95_REGISTER_FIFO_ACCESS, data + written, count)) return false;
+			written += count;
+		}
 
-	// Now sleep until the real scheduled time.
-	handle->precision_sleep_until(scheduled_time);
+		if ((int32_t)(handle->get_precision_tick() - timeout_tick) >= 0) return false;
+	}
 
-	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_RX_SINGLE)) return false;
+	// Wait for the packet sent interrupt.
+	if (!wait_for_irq(handle, RFM95_INTERRUPT_DIO0, RFM95_SEND_TIMEOUT + time_on_air_ms)) return false;
 
-	return true;
+	return write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_SLEEP);
 }
 
-static void calculate_rx_timings(rfm95_handle_t *handle, uint32_t bw, uint8_t sf, uint32_t tx_ticks,
-                                 uint32_t *rx_target, uint32_t *rx_window_symbols)
+bool rfm95_fsk_receive(rfm95_handle_t *handle, uint8_t *buffer, size_t buffer_size, size_t *length,
+                       uint32_t timeout_ms)
 {
-	volatile int32_t symbol_rate_ns = (int32_t)(((2 << (sf - 1)) * 1000000) / bw);
+	const rfm95_fsk_config_t *config = &handle->fsk_config;
 
-	volatile int32_t rx_timing_error_ns = (int32_t)(handle->precision_tick_drift_ns_per_s * handle->config.rx1_delay);
-	volatile int32_t rx_window_ns = 2 * symbol_rate_ns + 2 * rx_timing_error_ns;
-	volatile int32_t rx_offset_ns = 4 * symbol_rate_ns - (rx_timing_error_ns / 2);
-	volatile int32_t rx_offset_ticks = (int32_t)(((int64_t)rx_offset_ns * (int64_t)handle->precision_tick_frequency) / 1000000);
-	*rx_target = tx_ticks + handle->precision_tick_frequency * handle->config.rx1_delay + rx_offset_ticks;
-	*rx_window_symbols = rx_window_ns / symbol_rate_ns;
-}
+	assert(handle->fsk_active);
 
-static bool receive_package(rfm95_handle_t *handle, uint32_t tx_ticks, uint8_t *payload_buf, size_t *payload_len,
-                            int8_t *snr)
-{
-	*payload_len = 0;
+	*length = 0;
 
-	uint32_t rx1_target, rx1_window_symbols;
-	calculate_rx_timings(handle, 125000, 7, tx_ticks, &rx1_target, &rx1_window_symbols);
+	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_FSK_STANDBY)) return false;
+	if (!write_register(handle, RFM95_REGISTER_FSK_FIFO_THRESH, RFM95_FSK_FIFO_THRESHOLD)) return false;
+	handle->interrupt_times[RFM95_INTERRUPT_DIO0] = 0;
+	handle->interrupt_times[RFM95_INTERRUPT_DIO1] = 0;
+	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_FSK_RX)) return false;
 
-	assert(rx1_window_symbols <= 0x3ff);
+	uint32_t timeout_tick = handle->get_precision_tick() +
+	                        (uint32_t)((uint64_t)timeout_ms * handle->precision_tick_frequency / 1000);
 
-	// Configure modem (125kHz, 4/6 error coding rate, SF7, single packet, CRC enable, AGC auto on)
-	if (!write_register(handle, RFM95_REGISTER_MODEM_CONFIG_1, 0x72)) return false;
-	if (!write_register(handle, RFM95_REGISTER_MODEM_CONFIG_2, 0x74 | ((rx1_window_symbols >> 8) & 0x3))) return false;
-	if (!write_register(handle, RFM95_REGISTER_MODEM_CONFIG_3, 0x04)) return false;
+	size_t received = 0;
+	size_t expected = config->fixed_length;
+	bool poll = false;
 
-	// Set maximum symbol timeout.
-	if (!write_register(handle, RFM95_REGISTER_SYMB_TIMEOUT_LSB, rx1_window_symbols)) return false;
+	while ((int32_t)(handle->get_precision_tick() - timeout_tick) < 0) {
 
-	// Set IQ registers according to AN1200.24.
-	if (!write_register(handle, RFM95_REGISTER_INVERT_IQ_1, RFM95_REGISTER_INVERT_IQ_1_RX)) return false;
-	if (!write_register(handle, RFM95_REGISTER_INVERT_IQ_2, RFM95_REGISTER_INVERT_IQ_2_RX)) return false;
+		// The FIFO level and payload ready interrupts wake the loop, the flags tell how much can be read. The FIFO
+		// level interrupt fires only once per threshold crossing, so the flags are polled while the FIFO is drained.
+		if (!poll && handle->interrupt_times[RFM95_INTERRUPT_DIO0] == 0 &&
+		    handle->interrupt_times[RFM95_INTERRUPT_DIO1] == 0) {
+			continue;
+		}
 
-	receive_at_scheduled_time(handle, rx1_target);
+		handle->interrupt_times[RFM95_INTERRUPT_DIO0] = 0;
+		handle->interrupt_times[RFM95_INTERRUPT_DIO1] = 0;
 
-	// If there was nothing received during RX1, try RX2.
-	if (!wait_for_rx_irqs(handle)) {
+		uint8_t irq_flags;
+		if (!read_register(handle, RFM95_REGISTER_FSK_IRQ_FLAGS_2, &irq_flags, 1)) return false;
 
-		// Return modem to sleep.
-		if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_SLEEP)) return false;
+		bool valid = true;
+		bool payload_ready = (irq_flags & RFM95_REGISTER_FSK_IRQ_FLAGS_2_PAYLOAD_READY) != 0;
+		poll = (irq_flags & RFM95_REGISTER_FSK_IRQ_FLAGS_2_FIFO_LEVEL) != 0;
+
+		if (payload_ready) {
+			if (!fsk_read_fifo(handle, buffer, buffer_size, &received, &expected, SIZE_MAX, &valid)) return false;
+		} else if (poll) {
+			if (!fsk_read_fifo(handle, buffer, buffer_size, &received, &expected, RFM95_FSK_FIFO_THRESHOLD + 1,
+			                   &valid)) {
+				return false;
+			}
+		}
 
-		if (handle->receive_mode == RFM95_RECEIVE_MODE_RX12) {
+		// Packets too long for the buffer, failing the CRC or overrunning the FIFO are dropped.
+		if (!valid || (irq_flags & RFM95_REGISTER_FSK_IRQ_FLAGS_2_FIFO_OVERRUN) ||
+		    (payload_ready && config->crc && (irq_flags & RFM95_REGISTER_FSK_IRQ_FLAGS_2_CRC_OK) == 0)) {
+			if (!fsk_restart_receive(handle)) return false;
+			received = 0;
+			expected = config->fixed_length;
+			poll = false;
+			continue;
+		}
 
-			uint32_t rx2_target, rx2_window_symbols;
-			calculate_rx_timings(handle, 125000, 12, tx_ticks, &rx2_target, &rx2_window_symbols);
+		if (payload_ready) {
+			*length = received;
+			break;
+		}
+	}
 
-			// Configure 869.525 MHz
-			if (!configure_frequency(handle, 869525000)) return false;
+	return write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_SLEEP);
+}
 
-			// Configure modem SF12
-			if (!write_register(handle, RFM95_REGISTER_MODEM_CONFIG_1, 0xc2)) return false;
-			if (!write_register(handle, RFM95_REGISTER_MODEM_CONFIG_2, 0x74 | ((rx2_window_symbols >> 8) & 0x3))) return false;
-			if (!write_register(handle, RFM95_REGISTER_MODEM_CONFIG_3, 0x04)) return false;
+static bool restore_radio_state(rfm95_handle_t *handle)
+{
+	// Reception and transmission in progress were lost with the fault, the interrupt handler must not access the
+	// radio until they are restarted.
+	handle->continuous_receive_active = false;
+	handle->p2p_transmitting = false;
+
+	// Settings shared by all modes.
+	if (!configure_lora(handle)) return false;
+	if (!rfm95_set_power(handle, handle->tx_power)) return false;
+	if (!write_register(handle, RFM95_REGISTER_LNA, 0x23)) return false;
 
-			// Set maximum symbol timeout.
-			if (!write_register(handle, RFM95_REGISTER_SYMB_TIMEOUT_LSB, rx2_window_symbols)) return false;
+	if (handle->fsk_active) {
+		if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_SLEEP)) return false;
+		return fsk_configure(handle);
+	}
 
-			receive_at_scheduled_time(handle, rx2_target);
+	if (handle->p2p_active) {
+		if (!p2p_configure_modem(handle)) return false;
+		if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_STANDBY)) return false;
 
-			if (!wait_for_rx_irqs(handle)) {
-				// No payload during in RX1 and RX2
-				return true;
-			}
+		// Continue with the queued packets, or with reception once there are none.
+		handle->p2p_transmitting = true;
+		if (!p2p_transmit_next(handle)) {
+			handle->p2p_transmitting = false;
+			return false;
 		}
-
 		return true;
 	}
 
-	uint8_t irq_flags;
-	read_register(handle, RFM95_REGISTER_IRQ_FLAGS, &irq_flags, 1);
+	if (handle->receive_mode == RFM95_RECEIVE_MODE_CLASS_C) {
+		return start_continuous_receive(handle);
+	}
 
-	// Check if there was a CRC error.
-	if (irq_flags & 0x20) {
-		return true;
+	return true;
+}
+
+bool rfm95_recover(rfm95_handle_t *handle)
+{
+	for (uint8_t attempt = 0; attempt < RFM95_RECOVERY_ATTEMPTS; attempt++) {
+
+		handle->fault_pending = false;
+
+		// A radio still answering with its version kept its configuration, only the state of the current operation
+		// is restored. Otherwise it is reset first.
+		uint8_t version;
+		if (read_register(handle, RFM95_REGISTER_VERSION, &version, 1) && version == RFM9x_VER &&
+		    restore_radio_state(handle) && !handle->fault_pending) {
+			handle->fault_statistics.recovery_count++;
+			return true;
+		}
+
+		recover_spi(handle);
+		reset(handle);
+		handle->fault_statistics.radio_reset_count++;
 	}
 
-	int8_t packet_snr;
-	if (!read_register(handle, RFM95_REGISTER_PACKET_SNR, (uint8_t *)&packet_snr, 1)) return false;
-	*snr = (int8_t)(packet_snr / 4);
+	handle->fault_pending = true;
+	handle->fault_statistics.recovery_failure_count++;
 
-	// Read received payload length.
-	uint8_t payload_len_internal;
-	if (!read_register(handle, RFM95_REGISTER_FIFO_RX_BYTES_NB, &payload_len_internal, 1)) return false;
+	return false;
+}
 
-	// Read received payload itself.
-	if (!write_register(handle, RFM95_REGISTER_FIFO_ADDR_PTR, 0)) return false;
-	if (!read_register(handle, RFM95_REGISTER_FIFO_ACCESS, payload_buf, payload_len_internal)) return false;
+bool rfm95_fsk_stop(rfm95_handle_t *handle)
+{
+	if (!handle->fsk_active) {
+		return true;
+	}
 
-	// Return modem to sleep.
-	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_SLEEP)) return false;
+	handle->fsk_active = false;
+
+	// Switching back to LoRa resets the LoRaWAN modem settings.
+	if (!configure_lora(handle)) return false;
+
+	// Class C devices resume reception on the RX2 parameters.
+	if (handle->receive_mode == RFM95_RECEIVE_MODE_CLASS_C) {
+		return start_continuous_receive(handle);
+	}
 
-	// Successful payload receive, set payload length to tell caller.
-	*payload_len = payload_len_internal;
 	return true;
 }
 
-static bool send_package(rfm95_handle_t *handle, uint8_t *payload_buf, size_t payload_len, uint8_t channel,
-                         uint32_t *tx_ticks)
+bool rfm95_send_receive_cycle(rfm95_handle_t *handle, const uint8_t *send_data, size_t send_data_length)
 {
-	// Configure channel for transmission.
-	if (!configure_channel(handle, channel)) return false;
-
-	// Configure modem (125kHz, 4/6 error coding rate, SF7, single packet, CRC enable, AGC auto on)
-	if (!write_register(handle, RFM95_REGISTER_MODEM_CONFIG_1, 0x72)) return false;
-	if (!write_register(handle, RFM95_REGISTER_MODEM_CONFIG_2, 0x74)) return false;
-	if (!write_register(handle, RFM95_REGISTER_MODEM_CONFIG_3, 0x04)) return false;
+	return send_receive_cycle(handle, send_data, send_data_length, 1, false);
+}
 
-	// Set IQ registers according to AN1200.24.
-	if (!write_register(handle, RFM95_REGISTER_INVERT_IQ_1, RFM95_REGISTER_INVERT_IQ_1_TX)) return false;
-	if (!write_register(handle, RFM95_REGISTER_INVERT_IQ_2, RFM95_REGISTER_INVERT_IQ_2_TX)) return false;
+bool rfm95_send_confirmed_receive_cycle(rfm95_handle_t *handle, const uint8_t *send_data, size_t send_data_length)
+{
+	return send_receive_cycle(handle, send_data, send_data_length, 1, true);
+}
 
-	// Set the payload length.
-	if (!write_register(handle, RFM95_REGISTER_PAYLOAD_LENGTH, payload_len)) return false;
+/**
+ * Bit stream position within a codec payload, bits are written MSB first.
+ */
+typedef struct
+{
+	uint8_t *buffer;
+	size_t size;
+	size_t bit_index;
+} rfm95_bit_stream_t;
 
-	// Enable tx-done interrupt, clear flags and previous interrupt time.
-	if (!write_register(handle, RFM95_REGISTER_DIO_MAPPING_1, RFM95_REGISTER_DIO_MAPPING_1_IRQ_FOR_TXDONE)) return false;
-	if (!write_register(handle, RFM95_REGISTER_IRQ_FLAGS, 0xff)) return false;
-	handle->interrupt_times[RFM95_INTERRUPT_DIO0] = 0;
-	handle->interrupt_times[RFM95_INTERRUPT_DIO5] = 0;
+static bool write_bits(rfm95_bit_stream_t *stream, uint32_t value, uint8_t bits)
+{
+	if (stream->bit_index + bits > stream->size * 8) return false;
 
-	// Move modem to lora standby.
-	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_STANDBY)) return false;
+	for (uint8_t i = bits; i > 0; i--) {
+		uint8_t mask = 0x80 >> (stream->bit_index % 8);
+		if ((value >> (i - 1)) & 1) {
+			stream->buffer[stream->bit_index / 8] |= mask;
+		} else {
+			stream->buffer[stream->bit_index / 8] &= ~mask;
+		}
+		stream->bit_index++;
+	}
 
-	// Wait for the modem to be ready.
-	wait_for_irq(handle, RFM95_INTERRUPT_DIO5, RFM95_WAKEUP_TIMEOUT);
+	return true;
+}
 
-	// Set pointer to start of TX section in FIFO.
-	if (!write_register(handle, RFM95_REGISTER_FIFO_ADDR_PTR, 0x80)) return false;
+static bool read_bits(rfm95_bit_stream_t *stream, uint8_t bits, uint32_t *value)
+{
+	if (stream->bit_index + bits > stream->size * 8) return false;
 
-	// Write payload to FIFO.
-	for (size_t i = 0; i < payload_len; i++) {
-		write_register(handle, RFM95_REGISTER_FIFO_ACCESS, payload_buf[i]);
+	*value = 0;
+	for (uint8_t i = 0; i < bits; i++) {
+		uint8_t bit = (stream->buffer[stream->bit_index / 8] >> (7 - stream->bit_index % 8)) & 1;
+		*value = (*value << 1) | bit;
+		stream->bit_index++;
 	}
 
-	// Set modem to tx mode.
-	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_TX)) return false;
+	return true;
+}
 
-	// Wait for the transfer complete interrupt.
-	if (!wait_for_irq(handle, RFM95_INTERRUPT_DIO0, RFM95_SEND_TIMEOUT)) return false;
+static uint32_t codec_field_mask(const rfm95_codec_field_t *field)
+{
+	return field->bits >= 32 ? UINT32_MAX : (1u << field->bits) - 1;
+}
 
-	// Set real tx time in ticks.
-	*tx_ticks = handle->interrupt_times[RFM95_INTERRUPT_DIO0];
+static int32_t codec_sign_extend(const rfm95_codec_field_t *field, uint32_t value)
+{
+	if (field->bits < 32 && (value & (1u << (field->bits - 1)))) {
+		value |= ~codec_field_mask(field);
+	}
+	return (int32_t)value;
+}
 
-	// Return modem to sleep.
-	if (!write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_SLEEP)) return false;
+static bool codec_encode_frame(const rfm95_codec_t *codec, const int32_t *values, bool key_frame,
+                               rfm95_bit_stream_t *stream)
+{
+	if (!write_bits(stream, key_frame, 1)) return false;
+	if (!write_bits(stream, (codec->sequence + 1) & RFM95_CODEC_SEQUENCE_MASK, 4)) return false;
 
-	// Increment tx frame counter.
-	handle->config.tx_frame_count++;
+	for (uint8_t i = 0; i < codec->field_count; i++) {
+		const rfm95_codec_field_t *field = &codec->fields[i];
+		uint32_t value = (uint32_t)values[i] & codec_field_mask(field);
+
+		if (key_frame) {
+			if (!write_bits(stream, value, field->bits)) return false;
+			continue;
+		}
+
+		// The difference wraps at the field width, so it never needs more bits than the field itself. Zig-zag
+		// encoding maps small negative and positive differences to small unsigned numbers.
+		int32_t delta = codec_sign_extend(field, (value - codec->reference[i]) & codec_field_mask(field));
+		uint32_t zig_zag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+
+		// Groups of 3 bits, least significant first, each preceded by a bit telling whether another group follows.
+		do {
+			uint8_t group = zig_zag & 0x07;
+			zig_zag >>= 3;
+			if (!write_bits(stream, ((zig_zag != 0) << 3) | group, 4)) return false;
+		} while (zig_zag != 0);
+	}
 
 	return true;
 }
 
-static size_t encode_phy_payload(rfm95_handle_t *handle, uint8_t payload_buf[64], const uint8_t *frame_payload,
-                                 size_t frame_payload_length, uint8_t port)
+bool rfm95_send_encoded_receive_cycle(rfm95_handle_t *handle, rfm95_codec_t *codec, const int32_t *values)
 {
-	size_t payload_len = 0;
-
-	// 64 bytes is maximum size of FIFO
-	assert(frame_payload_length + 4 + 9 <= 64);
+	assert(codec->field_count <= RFM95_CODEC_FIELD_COUNT_MAX);
+
+	uint8_t key_buffer[RFM95_PAYLOAD_MAX_LENGTH] = { 0 };
+	uint8_t delta_buffer[RFM95_PAYLOAD_MAX_LENGTH] = { 0 };
+	size_t max_payload_length = data_rate_configs[handle->config.tx_data_rate].max_payload_length;
+
+	rfm95_bit_stream_t key_stream = { key_buffer, max_payload_length, 0 };
+	rfm95_bit_stream_t delta_stream = { delta_buffer, max_payload_length, 0 };
+
+	bool key_fits = codec_encode_frame(codec, values, true, &key_stream);
+	bool delta_allowed = codec->has_reference && codec->delta_frame_count < codec->key_frame_interval;
+	bool delta_fits = delta_allowed && codec_encode_frame(codec, values, false, &delta_stream);
+
+	if (!key_fits && !delta_fits) return false;
+
+	size_t key_length = (key_stream.bit_index + 7) / 8;
+	size_t delta_length = (delta_stream.bit_index + 7) / 8;
+
+	// LoRa sends the payload in blocks of symbols, so a key frame is sent whenever it fits the same number of symbols
+	// as the delta frame. It costs no additional airtime and lets the receiver recover from lost up-links.
+	// A frame not fitting next to queued MAC command answers makes the up-link send them on their own first, so the
+	// key frame must not need this if the delta frame doesn't.
+	bool key_frame = !delta_fits;
+	if (key_fits && delta_fits) {
+		size_t overhead = 13 + handle->pending_mac_answers_length;
+		size_t available_length = rfm95_get_max_payload_length(handle);
+		key_frame = data_rate_time_on_air_us(handle->config.tx_data_rate, key_length + overhead) <=
+		            data_rate_time_on_air_us(handle->config.tx_data_rate, delta_length + overhead) &&
+		            (key_length <= available_length || delta_length > available_length);
+	}
 
-	payload_buf[0] = 0x40; // MAC Header
-	payload_buf[1] = handle->device_address[3];
-	payload_buf[2] = handle->device_address[2];
-	payload_buf[3] = handle->device_address[1];
-	payload_buf[4] = handle->device_address[0];
-	payload_buf[5] = 0x00; // Frame Control
-	payload_buf[6] = (handle->config.tx_frame_count & 0x00ffu);
-	payload_buf[7] = ((uint16_t)(handle->config.tx_frame_count >> 8u) & 0x00ffu);
-	payload_buf[8] = port; // Frame Port
-	payload_len += 9;
-
-	// Encrypt payload in place in payload_buf.
-	memcpy(payload_buf + payload_len, frame_payload, frame_payload_length);
-	if (port == 0) {
-		Encrypt_Payload(payload_buf + payload_len, frame_payload_length, handle->config.tx_frame_count,
-		                0, handle->network_session_key, handle->device_address);
+	if (key_frame) {
+		if (!send_receive_cycle(handle, key_buffer, key_length, 1, false)) return false;
 	} else {
-		Encrypt_Payload(payload_buf + payload_len, frame_payload_length, handle->config.tx_frame_count,
-		                0, handle->application_session_key, handle->device_address);
+		if (!send_receive_cycle(handle, delta_buffer, delta_length, 1, false)) return false;
 	}
-	payload_len += frame_payload_length;
 
-	// Calculate MIC and copy to last 4 bytes of the payload_buf.
-	uint8_t mic[4];
-	Calculate_MIC(payload_buf, mic, payload_len, handle->config.tx_frame_count, 0,
-	              handle->network_session_key, handle->device_address);
-	for (uint8_t i = 0; i < 4; i++) {
-		payload_buf[payload_len + i] = mic[i];
+	// The reference only advances once the frame was sent.
+	for (uint8_t i = 0; i < codec->field_count; i++) {
+		codec->reference[i] = (uint32_t)values[i] & codec_field_mask(&codec->fields[i]);
 	}
-	payload_len += 4;
+	codec->has_reference = true;
+	codec->sequence = (codec->sequence + 1) & RFM95_CODEC_SEQUENCE_MASK;
+	codec->delta_frame_count = key_frame ? 0 : codec->delta_frame_count + 1;
 
-	return payload_len;
+	return true;
 }
 
-static bool decode_phy_payload(rfm95_handle_t *handle, uint8_t payload_buf[64], uint8_t payload_length,
-                               uint8_t **decoded_frame_payload_ptr, uint8_t *decoded_frame_payload_length, uint8_t *frame_port)
+bool rfm95_decode_payload(rfm95_codec_t *codec, const uint8_t *payload, size_t payload_length, int32_t *values)
 {
-	// Only unconfirmed down-links are supported for now.
-	if (payload_buf[0] != 0x60) {
-		return false;
-	}
+	assert(codec->field_count <= RFM95_CODEC_FIELD_COUNT_MAX);
 
-	// Does the device address match?
-	if (payload_buf[1] != handle->device_address[3] || payload_buf[2] != handle->device_address[2] ||
-	    payload_buf[3] != handle->device_address[1] || payload_buf[4] != handle->device_address[0]) {
+	rfm95_bit_stream_t stream = { (uint8_t *)payload, payload_length, 0 };
+	uint32_t decoded[RFM95_CODEC_FIELD_COUNT_MAX];
+
+	uint32_t key_frame, sequence;
+	if (!read_bits(&stream, 1, &key_frame)) return false;
+	if (!read_bits(&stream, 4, &sequence)) return false;
+
+	// Delta frames can not be decoded without the previous frame. After a lost frame the reference is dropped, any
+	// further delta frame would decode to wrong values until the next key frame.
+	if (!key_frame && (!codec->has_reference || sequence != ((codec->sequence + 1) & RFM95_CODEC_SEQUENCE_MASK))) {
+		codec->has_reference = false;
 		return false;
 	}
 
-	uint8_t frame_control = payload_buf[5];
-	uint8_t frame_opts_length = frame_control & 0x0f;
-	uint16_t rx_frame_count = (payload_buf[7] << 8) | payload_buf[6];
+	for (uint8_t i = 0; i < codec->field_count; i++) {
+		const rfm95_codec_field_t *field = &codec->fields[i];
 
-	// Check if rx frame count is valid and if so, update accordingly.
-	if (rx_frame_count < handle->config.rx_frame_count) {
-		return false;
+		if (key_frame) {
+			if (!read_bits(&stream, field->bits, &decoded[i])) return false;
+			continue;
+		}
+
+		uint32_t zig_zag = 0;
+		uint32_t group;
+		uint8_t shift = 0;
+		do {
+			if (shift >= 33 || !read_bits(&stream, 4, &group)) return false;
+			zig_zag |= (group & 0x07) << shift;
+			shift += 3;
+		} while (group & 0x08);
+
+		uint32_t delta = (zig_zag >> 1) ^ (0 - (zig_zag & 1));
+		decoded[i] = (codec->reference[i] + delta) & codec_field_mask(field);
 	}
-	handle->config.rx_frame_count = rx_frame_count;
 
-	uint8_t check_mic[4];
-	Calculate_MIC(payload_buf, check_mic, payload_length - 4, rx_frame_count, 1,
-	              handle->network_session_key, handle->device_address);
-	if (memcmp(check_mic, &payload_buf[payload_length - 4], 4) != 0) {
+	// Values are only taken over once the whole frame was decoded.
+	for (uint8_t i = 0; i < codec->field_count; i++) {
+		const rfm95_codec_field_t *field = &codec->fields[i];
+		codec->reference[i] = decoded[i];
+		values[i] = field->is_signed ? codec_sign_extend(field, decoded[i]) : (int32_t)decoded[i];
+	}
+	codec->has_reference = true;
+	codec->sequence = (uint8_t)sequence;
+
+	return true;
+}
+
+bool rfm95_setup_fragmentation_session(rfm95_handle_t *handle, uint8_t fragment_index, uint8_t *buffer,
+                                       uint16_t fragment_count, uint8_t fragment_size)
+{
+	if (fragment_index > 3 || fragment_count == 0 || fragment_count > RFM95_FRAGMENT_COUNT_MAX ||
+	    fragment_size == 0 || fragment_size > RFM95_FRAGMENT_SIZE_MAX) {
 		return false;
 	}
 
-	if (payload_length - 12 - frame_opts_length == 0) {
-		*frame_port = 0;
-		*decoded_frame_payload_ptr = &payload_buf[8];
-		*decoded_frame_payload_length = frame_opts_length;
+	rfm95_fragmentation_session_t *session = &handle->fragmentation_session;
+	memset(session, 0, sizeof(*session));
 
-	} else {
-		*frame_port = payload_buf[8];
+	session->buffer = buffer;
+	session->fragment_index = fragment_index;
+	session->fragment_count = fragment_count;
+	session->fragment_size = fragment_size;
 
-		uint8_t frame_payload_start = 9 + frame_opts_length;
-		uint8_t frame_payload_end = payload_length - 4;
-		uint8_t frame_payload_length = frame_payload_end - frame_payload_start;
+	return true;
+}
 
-		if (*frame_port == 0) {
-			Encrypt_Payload(&payload_buf[frame_payload_start], frame_payload_length, rx_frame_count,
-			                1, handle->network_session_key, handle->device_address);
+bool rfm95_send_fragmented(rfm95_handle_t *handle, const uint8_t *data, size_t data_length, uint8_t fragment_size,
+                           uint16_t redundancy, uint16_t *sent_count)
+{
+	assert(fragment_size > 0 && fragment_size <= RFM95_FRAGMENT_SIZE_MAX);
+
+	uint16_t fragment_count = (data_length + fragment_size - 1) / fragment_size;
+	assert(fragment_count <= RFM95_FRAGMENT_COUNT_MAX && fragment_count + redundancy <= 0x3fff);
+
+	uint8_t payload[3 + RFM95_FRAGMENT_SIZE_MAX];
+	uint8_t parity_row[RFM95_FRAGMENT_COUNT_MAX / 8];
+
+	// Sending continues behind the fragments already sent, so a call failing for example on the duty cycle can be
+	// repeated later.
+	for (uint16_t n = *sent_count + 1; n <= fragment_count + redundancy; n++) {
+
+		payload[0] = RFM95_FRAGMENT_DATA_FRAGMENT;
+		payload[1] = (uint8_t)n;
+		payload[2] = (uint8_t)(n >> 8);
+		memset(payload + 3, 0, fragment_size);
+
+		// The first fragments carry the data as is, the last one zero padded. Coded fragments follow, each the XOR
+		// of a pseudo random half of the uncoded ones.
+		if (n <= fragment_count) {
+			fragment_xor_data(payload + 3, data, data_length, n - 1, fragment_size);
 		} else {
-			Encrypt_Payload(&payload_buf[frame_payload_start], frame_payload_length, rx_frame_count,
-			                1, handle->application_session_key, handle->device_address);
+			fragment_parity_row(n - fragment_count, fragment_count, parity_row);
+			for (uint16_t fragment = 0; fragment < fragment_count; fragment++) {
+				if (fragment_bit(parity_row, fragment)) {
+					fragment_xor_data(payload + 3, data, data_length, fragment, fragment_size);
+				}
+			}
 		}
 
-		*decoded_frame_payload_ptr = &payload_buf[frame_payload_start];
-		*decoded_frame_payload_length = frame_payload_length;
+		if (!send_receive_cycle(handle, payload, 3 + fragment_size, RFM95_FRAGMENTATION_PORT, false)) return false;
+		*sent_count = n;
 	}
 
 	return true;
 }
 
-static uint8_t select_random_channel(rfm95_handle_t *handle)
+static void dequeue_uplink_records(rfm95_handle_t *handle, uint8_t record_count, size_t length)
 {
-	uint8_t channel_count = 0;
+	handle->uplink_queue_length -= length;
+	handle->uplink_queue_record_count -= record_count;
 
-	for (uint8_t i = 0; i < 16; i++) {
-		if (handle->config.channel_mask & (1 << i)) {
-			channel_count++;
-		}
+	memmove(handle->uplink_queue, handle->uplink_queue + length, handle->uplink_queue_length);
+	memmove(handle->uplink_queue_record_lengths, handle->uplink_queue_record_lengths + record_count,
+	        handle->uplink_queue_record_count);
+}
+
+bool rfm95_flush_uplink_queue(rfm95_handle_t *handle)
+{
+	if (handle->uplink_queue_length == 0) {
+		return true;
 	}
 
-	uint8_t random_channel = handle->random_int(channel_count);
+	// The data rate may have been lowered since the records were queued, only the leading records fitting into the
+	// frame are sent and the others stay queued. MAC command answers not fitting next to them are sent by the up-link
+	// cycle in empty up-links first.
+	size_t max_payload_length = data_rate_configs[handle->config.tx_data_rate].max_payload_length;
 
-	for (uint8_t i = 0; i < 16; i++) {
-		if (handle->config.channel_mask & (1 << i)) {
-			if (random_channel == 0) {
-				return i;
-			} else {
-				random_channel--;
-			}
-		}
+	// A record larger than the frame could never be sent at this data rate, it would block the queue for good.
+	if (handle->uplink_queue_record_lengths[0] > max_payload_length) {
+		dequeue_uplink_records(handle, 1, handle->uplink_queue_record_lengths[0]);
+		return false;
+	}
+
+	uint8_t record_count = 0;
+	size_t length = 0;
+	while (record_count < handle->uplink_queue_record_count &&
+	       length + handle->uplink_queue_record_lengths[record_count] <= max_payload_length) {
+		length += handle->uplink_queue_record_lengths[record_count++];
 	}
 
-	return 0;
+	// Records stay queued if sending failed so the application may retry.
+	if (!send_receive_cycle(handle, handle->uplink_queue, length, 1, false)) return false;
+
+	dequeue_uplink_records(handle, record_count, length);
+	return true;
 }
 
-bool rfm95_send_receive_cycle(rfm95_handle_t *handle, const uint8_t *send_data, size_t send_data_length)
+bool rfm95_enqueue_uplink(rfm95_handle_t *handle, const uint8_t *record, size_t record_length, uint32_t deadline_ticks)
 {
-	uint8_t phy_payload_buf[64] = { 0 };
+	assert(record_length != 0 && record_length <= RFM95_UPLINK_QUEUE_LENGTH);
 
-	// Build the up-link phy payload.
-	size_t phy_payload_len = encode_phy_payload(handle, phy_payload_buf, send_data, send_data_length, 1);
+	if (record_length > data_rate_configs[handle->config.tx_data_rate].max_payload_length) {
+		return false;
+	}
 
-	uint8_t random_channel = select_random_channel(handle);
+	// Records are never split across frames, send the queued ones first if this one does not fit anymore. A flush
+	// removing no record failed to send, the record is then not queued.
+	while (handle->uplink_queue_record_count != 0 &&
+	       (handle->uplink_queue_length + record_length > rfm95_get_max_payload_length(handle) ||
+	        handle->uplink_queue_length + record_length > RFM95_UPLINK_QUEUE_LENGTH ||
+	        handle->uplink_queue_record_count == RFM95_UPLINK_QUEUE_RECORD_COUNT_MAX)) {
+		uint8_t record_count = handle->uplink_queue_record_count;
+		if (!rfm95_flush_uplink_queue(handle) && handle->uplink_queue_record_count == record_count) return false;
+	}
 
-	uint32_t tx_ticks;
+	// The queue is due by the earliest deadline of its records.
+	if (handle->uplink_queue_length == 0 || (int32_t)(deadline_ticks - handle->uplink_queue_deadline) < 0) {
+		handle->uplink_queue_deadline = deadline_ticks;
+	}
 
-	// Send the requested up-link.
-	if (!send_package(handle, phy_payload_buf, phy_payload_len, random_channel, &tx_ticks)) {
-		write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_SLEEP);
-		return false;
+	memcpy(handle->uplink_queue + handle->uplink_queue_length, record, record_length);
+	handle->uplink_queue_length += record_length;
+	handle->uplink_queue_record_lengths[handle->uplink_queue_record_count++] = (uint8_t)record_length;
+
+	size_t flush_threshold = rfm95_get_max_payload_length(handle);
+	if (handle->uplink_queue_flush_threshold != 0 && handle->uplink_queue_flush_threshold < flush_threshold) {
+		flush_threshold = handle->uplink_queue_flush_threshold;
 	}
 
-	// Clear phy payload buffer to reuse for the down-link message.
-	memset(phy_payload_buf, 0x00, sizeof(phy_payload_buf));
-	phy_payload_len = 0;
+	// The record is queued either way, a failed send is retried by rfm95_process_uplink_queue as the queue is due now.
+	if (handle->uplink_queue_length >= flush_threshold && !rfm95_flush_uplink_queue(handle)) {
+		handle->uplink_queue_deadline = handle->get_precision_tick();
+	}
 
-	// Only receive if configured to do so.
-	if (handle->receive_mode != RFM95_RECEIVE_MODE_NONE) {
+	return true;
+}
 
-		int8_t snr;
+bool rfm95_process_uplink_queue(rfm95_handle_t *handle)
+{
+	if (handle->uplink_queue_length == 0) {
+		return true;
+	}
 
-		// Try receiving a down-link.
-		if (!receive_package(handle, tx_ticks, phy_payload_buf, &phy_payload_len, &snr)) {
-			write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_SLEEP);
-			if (handle->save_config) {
-				handle->save_config(&(handle->config));
-			}
-			return false;
+	if ((int32_t)(handle->get_precision_tick() - handle->uplink_queue_deadline) < 0) {
+		return true;
+	}
+
+	return rfm95_flush_uplink_queue(handle);
+}
+
+static void handle_dio0_interrupt(rfm95_handle_t *handle)
+{
+	// Queued point-to-point packets are sent back to back, each loaded into the FIFO as soon as the previous one is
+	// done.
+	if (handle->p2p_transmitting) {
+		handle->p2p_tx_count++;
+		if (!p2p_transmit_next(handle)) {
+			handle->p2p_transmitting = false;
 		}
+		return;
+	}
 
-		// Any RX payload was received.
-		if (phy_payload_len != 0) {
+	// In continuous reception packets are moved into the receive ring right away.
+	if (handle->continuous_receive_active) {
+		receive_continuous_packet(handle);
+	}
+}
 
-			uint8_t *frame_payload;
-			uint8_t frame_payload_len = 0;
-			uint8_t frame_port;
+void rfm95_on_interrupt(rfm95_handle_t *handle, rfm95_interrupt_t interrupt)
+{
+	handle->interrupt_times[interrupt] = handle->get_precision_tick();
 
-			// Try decoding the frame payload.
-			if (decode_phy_payload(handle, phy_payload_buf, phy_payload_len, &frame_payload, &frame_payload_len,
-			                       &frame_port)) {
+	if (interrupt != RFM95_INTERRUPT_DIO0) {
+		return;
+	}
 
-				// Process Mac Commands
-				if (frame_port == 0) {
+	// An interrupted transaction must not be interleaved with the FIFO access of the interrupt handler, whether on a
+	// shared bus or the device's own one. The interrupt is handled once that transaction is done.
+	if (*transaction_depth(handle) != 0) {
+		handle->interrupt_deferred = true;
+		return;
+	}
 
-					uint8_t mac_response_data[51] = {0};
-					uint8_t mac_response_len = 0;
+	handle->interrupt_deferred = false;
 
-					if (process_mac_commands(handle, frame_payload, frame_payload_len, mac_response_data,
-					                         &mac_response_len, snr) && mac_response_len != 0) {
+	transaction_begin(handle);
+	handle_dio0_interrupt(handle);
+	transaction_end(handle);
+}
 
-						// Build the up-link phy payload.
-						phy_payload_len = encode_phy_payload(handle, phy_payload_buf, mac_response_data,
-						                                     mac_response_len, 0);
+void rfm95_bus_init(rfm95_bus_t *bus, SPI_HandleTypeDef *spi_handle)
+{
+	bus->spi_handle = spi_handle;
+	bus->handle_count = 0;
+	bus->transaction_depth = 0;
+}
 
-						if (!send_package(handle, phy_payload_buf, phy_payload_len, random_channel,
-						                  &tx_ticks)) {
-							write_register(handle, RFM95_REGISTER_OP_MODE, RFM95_REGISTER_OP_MODE_LORA_SLEEP);
-							if (handle->save_config) {
-								handle->save_config(&(handle->config));
-							}
-							return false;
-						}
-					}
+bool rfm95_bus_add(rfm95_bus_t *bus, rfm95_handle_t *handle)
+{
+	assert(handle->spi_handle == bus->spi_handle);
 
-				} else {
-					// Don't process application messages for now!
-				}
-			}
-		}
+	if (bus->handle_count == RFM95_BUS_HANDLE_COUNT_MAX) {
+		return false;
 	}
 
-	if (handle->save_config) {
-		handle->save_config(&(handle->config));
-	}
+	handle->bus = bus;
+	handle->interrupt_deferred = false;
+	bus->handles[bus->handle_count++] = handle;
 
 	return true;
 }
 
-void rfm95_on_interrupt(rfm95_handle_t *handle, rfm95_interrupt_t interrupt)
+void rfm95_bus_on_interrupt(rfm95_bus_t *bus, uint16_t gpio_pin)
 {
-	handle->interrupt_times[interrupt] = handle->get_precision_tick();
+	// Route the line to the device and DIO it belongs to.
+	for (uint8_t i = 0; i < bus->handle_count; i++) {
+		for (uint8_t interrupt = 0; interrupt < RFM95_INTERRUPT_COUNT; interrupt++) {
+			if (bus->handles[i]->dio_pins[interrupt] == gpio_pin) {
+				rfm95_on_interrupt(bus->handles[i], (rfm95_interrupt_t)interrupt);
+				return;
+			}
+		}
+	}
 }
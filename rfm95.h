@@ -33,6 +33,14 @@
 #define RFM95_SPI_TIMEOUT 10
 #endif
 
+#ifndef RFM95_SPI_RETRY_COUNT
+#define RFM95_SPI_RETRY_COUNT 2
+#endif
+
+#ifndef RFM95_RECOVERY_ATTEMPTS
+#define RFM95_RECOVERY_ATTEMPTS 3
+#endif
+
 #ifndef RFM95_WAKEUP_TIMEOUT
 #define RFM95_WAKEUP_TIMEOUT 10
 #endif
@@ -45,53 +53,749 @@
 #define RFM95_RECEIVE_TIMEOUT 1000
 #endif
 
-#define RFM95_EEPROM_CONFIG_MAGIC 0xab67
+#ifndef RFM95_CONFIRMED_NB_TRANS
+#define RFM95_CONFIRMED_NB_TRANS 8
+#endif
+
+#ifndef RFM95_MULTICAST_SESSION_COUNT
+#define RFM95_MULTICAST_SESSION_COUNT 4
+#endif
+
+#define RFM95_PHY_PAYLOAD_MAX_LENGTH 255
+
+#define RFM95_PAYLOAD_MAX_LENGTH 242
+
+#ifndef RFM95_FRAGMENT_COUNT_MAX
+#define RFM95_FRAGMENT_COUNT_MAX 512
+#endif
+
+#ifndef RFM95_FRAGMENT_LOST_MAX
+#define RFM95_FRAGMENT_LOST_MAX 32
+#endif
+
+#define RFM95_FRAGMENT_SIZE_MAX (RFM95_PAYLOAD_MAX_LENGTH - 3)
+
+#define RFM95_FRAGMENTATION_PORT 201
+
+#ifndef RFM95_CODEC_FIELD_COUNT_MAX
+#define RFM95_CODEC_FIELD_COUNT_MAX 16
+#endif
+
+#define RFM95_CODEC_SEQUENCE_MASK 0x0f
+
+#define RFM95_EEPROM_CONFIG_MAGIC 0xab6b
+
+#ifndef RFM95_FRAME_COUNT_COMMIT_INTERVAL
+#define RFM95_FRAME_COUNT_COMMIT_INTERVAL 16
+#endif
+
+#define RFM95_JOURNAL_CHUNK_SIZE 4
+
+#define RFM95_CONFIG_FORMAT_VERSION 1
+
+/**
+ * Largest serialised config: version, frame counters, RX1 delay, four data rate bytes, RX2 frequency, NbTrans and
+ * channel mask, then four bytes per present channel and the CRC.
+ */
+#define RFM95_CONFIG_SERIALIZED_SIZE_MAX (15 + 16 * 4 + 2)
+
+/**
+ * The regional channel plan is selected at build time by defining one of RFM95_REGION_EU868, RFM95_REGION_US915,
+ * RFM95_REGION_AU915, RFM95_REGION_AS923 or RFM95_REGION_IN865. EU868 is used if none is defined.
+ */
+#if !defined(RFM95_REGION_EU868) && !defined(RFM95_REGION_US915) && !defined(RFM95_REGION_AU915) && \
+    !defined(RFM95_REGION_AS923) && !defined(RFM95_REGION_IN865)
+#define RFM95_REGION_EU868
+#endif
+
+#if defined(RFM95_REGION_US915) || defined(RFM95_REGION_AU915)
+
+/**
+ * Sub-band (1 to 8) of the fixed US915 and AU915 channel plans, each consisting of eight 125kHz channels and one
+ * 500kHz channel.
+ */
+#ifndef RFM95_FIXED_CHANNEL_SUB_BAND
+#define RFM95_FIXED_CHANNEL_SUB_BAND 2
+#endif
+
+#define RFM95_DATA_RATE_COUNT 14
+
+#else
+
+#define RFM95_DATA_RATE_COUNT 7
+
+#endif
+
+/**
+ * LoRaWAN data rates, the modulation of each data rate is defined by the selected region.
+ */
+typedef enum
+{
+	RFM95_DATA_RATE_0,
+	RFM95_DATA_RATE_1,
+	RFM95_DATA_RATE_2,
+	RFM95_DATA_RATE_3,
+	RFM95_DATA_RATE_4,
+	RFM95_DATA_RATE_5,
+	RFM95_DATA_RATE_6,
+	RFM95_DATA_RATE_7,
+	RFM95_DATA_RATE_8,
+	RFM95_DATA_RATE_9,
+	RFM95_DATA_RATE_10,
+	RFM95_DATA_RATE_11,
+	RFM95_DATA_RATE_12,
+	RFM95_DATA_RATE_13,
+} rfm95_data_rate_t;
+
+typedef struct {
+
+	/**
+	 * Channel frequency in Hz.
+	 */
+	uint32_t frequency;
+
+	/**
+	 * Frequency register values (MSB, MID, LSB) precomputed from the frequency.
+	 */
+	uint8_t frf[3];
+
+	/**
+	 * Lowest data rate the channel may be used with.
+	 */
+	uint8_t min_data_rate;
+
+	/**
+	 * Highest data rate the channel may be used with.
+	 */
+	uint8_t max_data_rate;
+
+} rfm95_channel_config_t;
+
+typedef struct {
+
+	/**
+	 * MAGIC
+	 */
+	uint16_t magic;
+
+	/**
+	 * The current RX frame counter value.
+	 */
+	uint16_t rx_frame_count;
+
+	/**
+	 * The current TX frame counter value.
+	 */
+	uint16_t tx_frame_count;
+
+	/**
+	 * The delay to the RX1 window.
+	 */
+	uint8_t rx1_delay;
+
+	/**
+	 * The data rate used for up-links, one of rfm95_data_rate_t.
+	 */
+	uint8_t tx_data_rate;
+
+	/**
+	 * The offset between the up-link data rate and the RX1 down-link data rate.
+	 */
+	uint8_t rx1_data_rate_offset;
+
+	/**
+	 * The data rate of the RX2 window, one of rfm95_data_rate_t.
+	 */
+	uint8_t rx2_data_rate;
+
+	/**
+	 * The frequency of the RX2 window.
+	 */
+	uint32_t rx2_frequency;
+
+	/**
+	 * The maximum number of transmissions of a confirmed up-link.
+	 */
+	uint8_t nb_trans;
+
+	/**
+	 * The configuration of channels;
+	 */
+	rfm95_channel_config_t channels[16];
+
+	/**
+	 * Mask defining which channels are configured.
+	 */
+	uint16_t channel_mask;
+
+} rfm95_eeprom_config_t;
+
+/**
+ * Size of the stored config image, the serialised config rounded up to whole journal chunks.
+ */
+#define RFM95_STORAGE_IMAGE_SIZE \
+	((RFM95_CONFIG_SERIALIZED_SIZE_MAX + RFM95_JOURNAL_CHUNK_SIZE - 1) / RFM95_JOURNAL_CHUNK_SIZE * \
+	 RFM95_JOURNAL_CHUNK_SIZE)
+
+/**
+ * State of the journal the config is persisted in.
+ */
+typedef struct {
+
+	/**
+	 * The config image as currently stored, changed chunks are found by comparing against it.
+	 */
+	uint8_t image[RFM95_STORAGE_IMAGE_SIZE];
+
+	/**
+	 * Set once the image reflects the stored config.
+	 */
+	bool image_valid;
+
+	/**
+	 * Which of the two snapshots is the current one.
+	 */
+	uint8_t snapshot_index;
+
+	/**
+	 * Sequence number of the next snapshot or journal record.
+	 */
+	uint16_t sequence;
+
+	/**
+	 * Next journal slot to write, the journal is full once it reaches slot_count.
+	 */
+	uint16_t head;
+
+	/**
+	 * Number of journal slots fitting in the storage region next to the two snapshots.
+	 */
+	uint16_t slot_count;
+
+	/**
+	 * The TX frame counter value last committed to storage.
+	 */
+	uint16_t committed_tx_frame_count;
+
+} rfm95_journal_t;
+
+/**
+ * Reception metadata of a down-link.
+ */
+typedef struct {
+
+	/**
+	 * The packet RSSI in dBm.
+	 */
+	int16_t rssi;
+
+	/**
+	 * The packet SNR in dB.
+	 */
+	int8_t snr;
+
+	/**
+	 * Whether the down-link was received via a multicast session.
+	 */
+	bool multicast;
+
+	/**
+	 * The receive window the down-link was received in, 1 or 2, or 0 for Class B ping slots and Class C reception.
+	 */
+	uint8_t rx_window;
+
+} rfm95_downlink_metadata_t;
+
+/**
+ * A packet received during continuous reception, waiting to be processed.
+ */
+typedef struct {
+
+	/**
+	 * The received phy payload.
+	 */
+	uint8_t payload[RFM95_PHY_PAYLOAD_MAX_LENGTH];
+
+	/**
+	 * Length of the received phy payload.
+	 */
+	uint8_t length;
+
+	/**
+	 * Reception metadata of the packet.
+	 */
+	rfm95_downlink_metadata_t metadata;
+
+} rfm95_rx_packet_t;
+
+/**
+ * Beacon tracking and ping slot state of a Class B device.
+ */
+typedef struct {
+
+	/**
+	 * Whether the device is synchronised to the beacon and opens ping slots.
+	 */
+	bool beacon_locked;
+
+	/**
+	 * GPS time in seconds of the current beacon period.
+	 */
+	uint32_t beacon_time;
+
+	/**
+	 * Precision tick at which the current beacon period started, received or predicted.
+	 */
+	uint32_t beacon_ticks;
+
+	/**
+	 * Number of beacons missed in a row since the last received one.
+	 */
+	uint8_t beacons_missed;
+
+	/**
+	 * Offset of the first ping slot in the current beacon period.
+	 */
+	uint16_t ping_offset;
+
+	/**
+	 * Index of the next ping slot to open in the current beacon period.
+	 */
+	uint16_t next_ping_slot;
+
+	/**
+	 * Frequency the beacon is received on.
+	 */
+	uint32_t beacon_frequency;
+
+	/**
+	 * Frequency and data rate the ping slots are opened on.
+	 */
+	uint32_t ping_slot_frequency;
+	uint8_t ping_slot_data_rate;
+
+} rfm95_class_b_state_t;
+
+/**
+ * Link statistics of a channel used to weight the channel selection.
+ */
+typedef struct {
+
+	/**
+	 * Recent transmission failures, decremented with every successful transmission.
+	 */
+	uint8_t tx_failures;
+
+	/**
+	 * Recent confirmed up-links without acknowledgement, decremented with every acknowledgement.
+	 */
+	uint8_t missed_acks;
+
+	/**
+	 * Averaged RSSI of RX1 down-links in dBm.
+	 */
+	int16_t rssi;
+
+	/**
+	 * Averaged SNR of RX1 down-links in dB.
+	 */
+	int8_t snr;
+
+	/**
+	 * Number of RX1 down-links received.
+	 */
+	uint16_t downlink_count;
+
+	/**
+	 * Recent channel activity detections before transmissions, decremented with every clear detection.
+	 */
+	uint8_t cad_busy;
+
+} rfm95_channel_statistics_t;
+
+/**
+ * Statistics of the listen before talk channel activity detection.
+ */
+typedef struct {
+
+	/**
+	 * Number of channel activity detections performed.
+	 */
+	uint32_t cad_count;
+
+	/**
+	 * Number of detections that found the channel busy.
+	 */
+	uint32_t busy_count;
+
+	/**
+	 * Number of times a busy channel was replaced by another channel.
+	 */
+	uint32_t channel_switch_count;
+
+	/**
+	 * Number of random backoffs because no other channel was available.
+	 */
+	uint32_t backoff_count;
+
+	/**
+	 * Number of transmissions made although every attempt found the channel busy.
+	 */
+	uint32_t forced_tx_count;
+
+} rfm95_lbt_statistics_t;
+
+/**
+ * Statistics of SPI faults and their recovery.
+ */
+typedef struct {
+
+	/**
+	 * Number of failed SPI transactions, including retried ones.
+	 */
+	uint32_t spi_error_count;
+
+	/**
+	 * Number of failed SPI transactions that succeeded on a retry.
+	 */
+	uint32_t spi_retry_success_count;
+
+	/**
+	 * Number of recoveries that restored the radio state.
+	 */
+	uint32_t recovery_count;
+
+	/**
+	 * Number of radio resets during recoveries because the radio did not answer or lost its state.
+	 */
+	uint32_t radio_reset_count;
+
+	/**
+	 * Number of recoveries that gave up after RFM95_RECOVERY_ATTEMPTS attempts.
+	 */
+	uint32_t recovery_failure_count;
+
+} rfm95_fault_statistics_t;
+
+/**
+ * Statistics of the wake-on-radio receive duty cycling.
+ */
+typedef struct {
+
+	/**
+	 * Number of channel activity detections performed.
+	 */
+	uint32_t sniff_count;
+
+	/**
+	 * Number of detections after which no packet was received.
+	 */
+	uint32_t false_wakeup_count;
+
+} rfm95_wake_on_radio_statistics_t;
+
+/**
+ * State of the autonomous transmission power control.
+ */
+typedef struct {
+
+	/**
+	 * Number of up-links since the last LinkCheckReq.
+	 */
+	uint8_t uplinks_since_link_check;
+
+	/**
+	 * Whether the last up-link carried a LinkCheckReq and whether its LinkCheckAns was received.
+	 */
+	bool link_check_pending;
+	bool link_check_answered;
+
+	/**
+	 * Demodulation margin in dB and number of gateways reported by the last LinkCheckAns.
+	 */
+	uint8_t margin;
+	uint8_t gateway_count;
+
+	/**
+	 * SNR of the down-link carrying the last LinkCheckAns.
+	 */
+	int8_t snr;
+
+	/**
+	 * Number of consecutive LinkCheckReq left unanswered.
+	 */
+	uint8_t missed_link_checks;
+
+} rfm95_power_control_t;
+
+/**
+ * A multicast group session receiving down-links in addition to the device's own session.
+ */
+typedef struct {
+
+	/**
+	 * The multicast group address.
+	 */
+	uint8_t device_address[4];
+
+	/**
+	 * The AES round keys expanded from the multicast network and application session keys, the first 16 bytes
+	 * being the keys themselves.
+	 */
+	uint8_t network_round_keys[176];
+	uint8_t application_round_keys[176];
+
+	/**
+	 * The CMAC subkeys derived from the network session key.
+	 */
+	uint8_t mic_subkey_1[16];
+	uint8_t mic_subkey_2[16];
+
+	/**
+	 * The current RX frame counter value of the session.
+	 */
+	uint16_t rx_frame_count;
+
+} rfm95_multicast_session_t;
+
+/**
+ * Reassembly state of a fragmented data block received on the fragmentation port.
+ */
+typedef struct {
+
+	/**
+	 * Buffer provided by the application receiving the block, fragment_count * fragment_size bytes.
+	 */
+	uint8_t *buffer;
+
+	/**
+	 * Number of uncoded fragments of the block.
+	 */
+	uint16_t fragment_count;
+
+	/**
+	 * Size of each fragment in bytes.
+	 */
+	uint8_t fragment_size;
+
+	/**
+	 * Fragmentation session index (0 to 3) fragments must carry.
+	 */
+	uint8_t fragment_index;
+
+	/**
+	 * Bitmap of uncoded fragments received before the first coded one.
+	 */
+	uint8_t received[RFM95_FRAGMENT_COUNT_MAX / 8];
+	uint16_t received_count;
+
+	/**
+	 * Lost fragments, fixed once the first coded fragment is received.
+	 */
+	uint16_t lost_fragments[RFM95_FRAGMENT_LOST_MAX];
+	uint16_t lost_count;
+	bool lost_frozen;
+
+	/**
+	 * Triangular matrix of equations over the lost fragments. The data of each equation is kept in the buffer in
+	 * place of the lost fragment it starts with.
+	 */
+	uint8_t matrix[RFM95_FRAGMENT_LOST_MAX][RFM95_FRAGMENT_LOST_MAX / 8];
+	uint8_t stored_rows[RFM95_FRAGMENT_LOST_MAX / 8];
+	uint16_t stored_row_count;
+
+	/**
+	 * Whether the block has been reassembled, or can not be as more than RFM95_FRAGMENT_LOST_MAX fragments were lost.
+	 */
+	bool complete;
+	bool failed;
+
+} rfm95_fragmentation_session_t;
+
+/**
+ * Field of a payload codec schema.
+ */
+typedef struct {
+
+	/**
+	 * Width of the field in bits (1 to 32), values are truncated to it.
+	 */
+	uint8_t bits;
+
+	/**
+	 * Whether decoded values are sign extended from the field width.
+	 */
+	bool is_signed;
+
+} rfm95_codec_field_t;
+
+/**
+ * Payload codec for integer sensor values. Key frames carry every field bit-packed at its width, delta frames carry
+ * the zig-zag encoded difference to the previous frame as variable length integers of 3 bit groups. Every frame starts
+ * with a 4 bit sequence number.
+ */
+typedef struct {
+
+	/**
+	 * Schema of the fields, at most RFM95_CODEC_FIELD_COUNT_MAX.
+	 */
+	const rfm95_codec_field_t *fields;
+	uint8_t field_count;
+
+	/**
+	 * Maximum number of delta frames sent in a row, bounding how long a lost up-link prevents decoding. 0 sends key
+	 * frames only.
+	 */
+	uint8_t key_frame_interval;
+
+	/**
+	 * Values of the previous frame which delta frames are relative to.
+	 */
+	uint32_t reference[RFM95_CODEC_FIELD_COUNT_MAX];
+	bool has_reference;
+
+	/**
+	 * Sequence number of the previous frame, delta frames are only decoded if they directly follow it.
+	 */
+	uint8_t sequence;
+
+	/**
+	 * Number of delta frames since the last key frame.
+	 */
+	uint8_t delta_frame_count;
+
+} rfm95_codec_t;
+
+/**
+ * Modulation and packet format of the raw LoRa point-to-point mode.
+ */
+typedef struct {
+
+	/**
+	 * Frequency in Hz.
+	 */
+	uint32_t frequency;
+
+	/**
+	 * Spreading factor (6 to 12), SF6 requires implicit header mode.
+	 */
+	uint8_t spreading_factor;
+
+	/**
+	 * Bandwidth in Hz, one of 7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000 or 500000.
+	 */
+	uint32_t bandwidth;
+
+	/**
+	 * Coding rate 4/(4 + coding_rate), 1 to 4.
+	 */
+	uint8_t coding_rate;
+
+	/**
+	 * Number of preamble symbols, 6 to 65535.
+	 */
+	uint16_t preamble_length;
+
+	/**
+	 * Sync word both modules must agree on, LoRaWAN networks use 0x34.
+	 */
+	uint8_t sync_word;
+
+	/**
+	 * Whether packets are sent without header, saving its symbols. All packets then have payload_length bytes.
+	 */
+	bool implicit_header;
+	uint8_t payload_length;
+
+	/**
+	 * Whether a payload CRC is appended and checked.
+	 */
+	bool crc;
+
+} rfm95_p2p_config_t;
+
+/**
+ * Packet waiting to be transmitted in point-to-point mode.
+ */
+typedef struct {
+
+	uint8_t payload[RFM95_PHY_PAYLOAD_MAX_LENGTH];
+	uint8_t length;
+
+} rfm95_p2p_tx_packet_t;
 
+/**
+ * Modulation and packet format of the FSK mode.
+ */
 typedef struct {
 
+	/**
+	 * Frequency in Hz.
+	 */
 	uint32_t frequency;
 
-} rfm95_channel_config_t;
+	/**
+	 * Bit rate in bits per second, 1200 to 300000.
+	 */
+	uint32_t bitrate;
 
-typedef struct {
+	/**
+	 * Frequency deviation in Hz, at most 250kHz minus half the bit rate.
+	 */
+	uint32_t frequency_deviation;
 
 	/**
-	 * MAGIC
+	 * Receiver bandwidth in Hz, rounded up to the next bandwidth supported by the modem (2.6kHz to 250kHz).
 	 */
-	uint16_t magic;
+	uint32_t rx_bandwidth;
 
 	/**
-	 * The current RX frame counter value.
+	 * Number of preamble bytes.
 	 */
-	uint16_t rx_frame_count;
+	uint16_t preamble_length;
 
 	/**
-	 * The current TX frame counter value.
+	 * Sync word of 1 to 8 bytes, the bytes must not be 0x00.
 	 */
-	uint16_t tx_frame_count;
+	uint8_t sync_word[8];
+	uint8_t sync_word_length;
 
 	/**
-	 * The delay to the RX1 window.
+	 * Whether Gaussian pulse shaping (BT = 0.5) is used, making the modulation GFSK.
 	 */
-	uint8_t rx1_delay;
+	bool gaussian;
 
 	/**
-	 * The configuration of channels;
+	 * Whether the payload is whitened, avoiding long runs of equal bits.
 	 */
-	rfm95_channel_config_t channels[16];
+	bool whitening;
 
 	/**
-	 * Mask defining which channels are configured.
+	 * Whether a CRC is appended and checked.
 	 */
-	uint16_t channel_mask;
+	bool crc;
 
-} rfm95_eeprom_config_t;
+	/**
+	 * Length of fixed length packets, up to 2047 bytes. Can be set to 0 for variable length packets of up to 255
+	 * bytes, which are preceded by a length byte.
+	 */
+	uint16_t fixed_length;
+
+} rfm95_fsk_config_t;
 
 typedef void (*rfm95_on_after_interrupts_configured)();
 
+typedef void (*rfm95_on_downlink)(uint8_t port, const uint8_t *payload, size_t payload_length,
+                                  const rfm95_downlink_metadata_t *metadata);
+
+typedef void (*rfm95_on_fragmented_block)(const uint8_t *data, size_t data_length);
+
 typedef bool (*rfm95_load_eeprom_config)(rfm95_eeprom_config_t *config);
 typedef void (*rfm95_save_eeprom_config)(const rfm95_eeprom_config_t *config);
 
+typedef bool (*rfm95_storage_read)(uint32_t address, uint8_t *buffer, size_t length);
+typedef bool (*rfm95_storage_write)(uint32_t address, const uint8_t *buffer, size_t length);
+
 typedef uint32_t (*rfm95_get_precision_tick)();
 typedef void (*rfm95_precision_sleep_until)(uint32_t ticks_target);
 
@@ -111,10 +815,50 @@ typedef enum
 	RFM95_RECEIVE_MODE_NONE,
 	RFM95_RECEIVE_MODE_RX1_ONLY,
 	RFM95_RECEIVE_MODE_RX12,
+	RFM95_RECEIVE_MODE_CLASS_B,
+	RFM95_RECEIVE_MODE_CLASS_C,
 } rfm95_receive_mode_t;
 
 #define RFM95_INTERRUPT_COUNT 3
 
+#define RFM95_FRAME_OPTIONS_MAX_LENGTH 15
+
+#ifdef RFM95_REGION_EU868
+#define RFM95_SUB_BAND_COUNT 6
+#else
+#define RFM95_SUB_BAND_COUNT 1
+#endif
+
+#define RFM95_CHANNEL_WEIGHT_MAX 8
+
+#define RFM95_PING_SLOT_PERIODICITY_MAX 7
+
+#ifndef RFM95_UPLINK_QUEUE_LENGTH
+#define RFM95_UPLINK_QUEUE_LENGTH RFM95_PAYLOAD_MAX_LENGTH
+#endif
+
+#if RFM95_UPLINK_QUEUE_LENGTH > 255
+#error "RFM95_UPLINK_QUEUE_LENGTH must not exceed 255"
+#endif
+
+#ifndef RFM95_UPLINK_QUEUE_RECORD_COUNT_MAX
+#define RFM95_UPLINK_QUEUE_RECORD_COUNT_MAX 32
+#endif
+
+#ifndef RFM95_RX_RING_SIZE
+#define RFM95_RX_RING_SIZE 4
+#endif
+
+#ifndef RFM95_P2P_TX_QUEUE_SIZE
+#define RFM95_P2P_TX_QUEUE_SIZE 2
+#endif
+
+#ifndef RFM95_BUS_HANDLE_COUNT_MAX
+#define RFM95_BUS_HANDLE_COUNT_MAX 4
+#endif
+
+struct rfm95_bus;
+
 /**
  * Structure defining a handle describing an RFM95(W) transceiver.
  */
@@ -145,6 +889,27 @@ typedef struct {
 	 */
 	uint16_t nrst_pin;
 
+	/**
+	 * The pins of DIO0, 1 and 5, only needed to dispatch interrupts through a shared bus.
+	 */
+	uint16_t dio_pins[RFM95_INTERRUPT_COUNT];
+
+	/**
+	 * The shared bus the device was added to, NULL if it has the SPI bus to itself.
+	 */
+	struct rfm95_bus *bus;
+
+	/**
+	 * Nesting depth of the transaction currently running on the device, 0 while it is free. Devices on a shared bus use
+	 * the depth of the bus instead.
+	 */
+	volatile uint8_t transaction_depth;
+
+	/**
+	 * Set if a DIO0 interrupt arrived during a transaction and its handling is still pending.
+	 */
+	volatile bool interrupt_deferred;
+
 	/**
 	 * The device address for the LoraWAN
 	 */
@@ -207,11 +972,69 @@ typedef struct {
 	 */
 	rfm95_save_eeprom_config save_config;
 
+	/**
+	 * Byte-range read and write functions of a non-volatile storage region of storage_size bytes, addresses are
+	 * relative to the start of the region. The config is journaled there with wear levelling and only changed parts
+	 * written. Takes precedence over reload_config and save_config, can be set to NULL to skip.
+	 */
+	rfm95_storage_read storage_read;
+	rfm95_storage_write storage_write;
+	uint32_t storage_size;
+
+	/**
+	 * State of the journal in the storage region.
+	 */
+	rfm95_journal_t journal;
+
+	/**
+	 * Maximum number of empty up-links sent to drain down-links the network signalled as pending.
+	 * Can be set to 0 to only report pending down-links via frame_pending.
+	 */
+	uint8_t frame_pending_max_polls;
+
+	/**
+	 * Whether channel activity detection is used to listen before each transmission.
+	 */
+	bool listen_before_talk;
+
+	/**
+	 * Class B ping slot periodicity, a ping slot is opened every 2^periodicity seconds (0 to 7).
+	 */
+	uint8_t ping_slot_periodicity;
+
+	/**
+	 * Number of queued record bytes at which the up-link queue is sent right away.
+	 * Can be set to 0 to only send full frames or when a deadline is reached.
+	 */
+	uint8_t uplink_queue_flush_threshold;
+
+	/**
+	 * Number of up-links after which a LinkCheckReq is sent to adjust the transmission power to the link margin.
+	 * Can be set to 0 to keep the power set with rfm95_set_power.
+	 */
+	uint8_t power_control_interval;
+
+	/**
+	 * Highest transmission power in dBm the power control may use, 17 or 20. Other values are treated as 17.
+	 */
+	int8_t power_control_max_power;
+
 	/**
 	 * Callback called after the interrupt functions have been properly configred;
 	 */
 	rfm95_on_after_interrupts_configured on_after_interrupts_configured;
 
+	/**
+	 * Callback called for every application down-link. The payload points into the driver's receive buffer and is
+	 * only valid for the duration of the call. Can be set to NULL to skip.
+	 */
+	rfm95_on_downlink on_downlink;
+
+	/**
+	 * Callback called once the block of the fragmentation session has been reassembled. Can be set to NULL to skip.
+	 */
+	rfm95_on_fragmented_block on_fragmented_block;
+
 	/**
 	 * The config saved into the eeprom.
 	 */
@@ -222,12 +1045,307 @@ typedef struct {
 	 */
 	volatile uint32_t interrupt_times[RFM95_INTERRUPT_COUNT];
 
+	/**
+	 * MAC command answers queued to be sent in the FOpts field of the next up-link.
+	 */
+	uint8_t pending_mac_answers[RFM95_FRAME_OPTIONS_MAX_LENGTH];
+
+	/**
+	 * Length of the queued MAC command answers.
+	 */
+	uint8_t pending_mac_answers_length;
+
+	/**
+	 * Whether a confirmed down-link has to be acknowledged with the next up-link.
+	 */
+	bool pending_ack;
+
+	/**
+	 * Set if the last received down-link signalled that further down-links are pending at the network.
+	 */
+	bool frame_pending;
+
+	/**
+	 * Duty cycle ledger: tick from which on each sub-band may be used again.
+	 */
+	uint32_t duty_cycle_available_ticks[RFM95_SUB_BAND_COUNT];
+
+	/**
+	 * Mask of sub-bands for which the duty cycle ledger currently restricts transmissions.
+	 */
+	uint8_t duty_cycle_restricted_sub_bands;
+
+	/**
+	 * Link statistics of each channel.
+	 */
+	rfm95_channel_statistics_t channel_statistics[16];
+
+	/**
+	 * Channels repeated according to their weight, picked from uniformly at random.
+	 */
+	uint8_t channel_schedule[16 * RFM95_CHANNEL_WEIGHT_MAX];
+
+	/**
+	 * Number of valid entries in the channel schedule.
+	 */
+	uint8_t channel_schedule_length;
+
+	/**
+	 * The channel mask the channel schedule was built for.
+	 */
+	uint16_t channel_schedule_mask;
+
+	/**
+	 * Set if the statistics changed since the channel schedule was built.
+	 */
+	bool channel_schedule_dirty;
+
+	/**
+	 * Statistics of the listen before talk channel activity detection.
+	 */
+	rfm95_lbt_statistics_t lbt_statistics;
+
+	/**
+	 * Set once an SPI transaction failed after all retries, until the radio state was recovered.
+	 */
+	volatile bool fault_pending;
+
+	/**
+	 * Set if the last up-link failed as the duty cycle allowed no channel, rfm95_get_next_tx_ticks tells when to retry.
+	 */
+	bool duty_cycle_blocked;
+
+	/**
+	 * Statistics of SPI faults and their recovery.
+	 */
+	rfm95_fault_statistics_t fault_statistics;
+
+	/**
+	 * Current transmission power in dBm.
+	 */
+	int8_t tx_power;
+
+	/**
+	 * State of the autonomous transmission power control.
+	 */
+	rfm95_power_control_t power_control;
+
+	/**
+	 * Records queued to be packed into the next up-link.
+	 */
+	uint8_t uplink_queue[RFM95_UPLINK_QUEUE_LENGTH];
+
+	/**
+	 * Length of the queued records.
+	 */
+	uint8_t uplink_queue_length;
+
+	/**
+	 * Lengths of the individual queued records, so only whole records are sent.
+	 */
+	uint8_t uplink_queue_record_lengths[RFM95_UPLINK_QUEUE_RECORD_COUNT_MAX];
+	uint8_t uplink_queue_record_count;
+
+	/**
+	 * Precision tick of the earliest deadline of the queued records.
+	 */
+	uint32_t uplink_queue_deadline;
+
+	/**
+	 * Fragmented data block being received, inactive while its buffer is NULL.
+	 */
+	rfm95_fragmentation_session_t fragmentation_session;
+
+	/**
+	 * Class B beacon tracking state.
+	 */
+	rfm95_class_b_state_t class_b;
+
+	/**
+	 * Set while the radio is in continuous reception and the interrupt handler reads received packets.
+	 */
+	volatile bool continuous_receive_active;
+
+	/**
+	 * Ring buffer of packets received during continuous reception, written by the interrupt handler only.
+	 */
+	rfm95_rx_packet_t rx_ring[RFM95_RX_RING_SIZE];
+
+	/**
+	 * Index of the next ring slot written by the interrupt handler.
+	 */
+	volatile uint8_t rx_ring_head;
+
+	/**
+	 * Index of the next ring slot processed by rfm95_process_downlinks or rfm95_p2p_receive.
+	 */
+	volatile uint8_t rx_ring_tail;
+
+	/**
+	 * Number of packets dropped because the receive ring was full.
+	 */
+	volatile uint32_t rx_ring_overflow_count;
+
+	/**
+	 * Set while the raw point-to-point mode owns the radio, with the configuration it was started with.
+	 */
+	bool p2p_active;
+	rfm95_p2p_config_t p2p_config;
+
+	/**
+	 * Whether the radio returns to continuous reception once the transmit queue is empty.
+	 */
+	bool p2p_receive;
+
+	/**
+	 * Set while a point-to-point packet is on air, the interrupt handler then starts the next queued packet.
+	 */
+	volatile bool p2p_transmitting;
+
+	/**
+	 * Queue of point-to-point packets waiting for transmission, consumed by the interrupt handler.
+	 */
+	rfm95_p2p_tx_packet_t p2p_tx_queue[RFM95_P2P_TX_QUEUE_SIZE];
+	volatile uint8_t p2p_tx_head;
+	volatile uint8_t p2p_tx_tail;
+
+	/**
+	 * Number of point-to-point packets transmitted.
+	 */
+	volatile uint32_t p2p_tx_count;
+
+	/**
+	 * Statistics of the wake-on-radio receive duty cycling.
+	 */
+	rfm95_wake_on_radio_statistics_t wake_on_radio_statistics;
+
+	/**
+	 * Set while the radio is switched to the FSK modem, with the configuration it was started with.
+	 */
+	bool fsk_active;
+	rfm95_fsk_config_t fsk_config;
+
+	/**
+	 * Multicast sessions sorted by device address.
+	 */
+	rfm95_multicast_session_t multicast_sessions[RFM95_MULTICAST_SESSION_COUNT];
+
+	/**
+	 * Number of active multicast sessions.
+	 */
+	uint8_t multicast_session_count;
+
 } rfm95_handle_t;
 
+/**
+ * Structure describing an SPI bus shared by several RFM95(W) transceivers.
+ */
+typedef struct rfm95_bus {
+
+	/**
+	 * The handle to the shared SPI bus.
+	 */
+	SPI_HandleTypeDef *spi_handle;
+
+	/**
+	 * The devices on the bus.
+	 */
+	rfm95_handle_t *handles[RFM95_BUS_HANDLE_COUNT_MAX];
+
+	/**
+	 * Number of devices on the bus.
+	 */
+	uint8_t handle_count;
+
+	/**
+	 * Nesting depth of the transaction currently running on the bus, 0 while the bus is free.
+	 */
+	volatile uint8_t transaction_depth;
+
+} rfm95_bus_t;
+
 bool rfm95_init(rfm95_handle_t *handle);
 
+bool rfm95_recover(rfm95_handle_t *handle);
+
+size_t rfm95_serialize_config(const rfm95_eeprom_config_t *config, uint8_t buffer[RFM95_CONFIG_SERIALIZED_SIZE_MAX]);
+
+bool rfm95_deserialize_config(rfm95_eeprom_config_t *config, const uint8_t *buffer, size_t length);
+
 bool rfm95_set_power(rfm95_handle_t *handle, int8_t power);
 
+void rfm95_set_data_rate(rfm95_handle_t *handle, rfm95_data_rate_t data_rate);
+
+bool rfm95_add_multicast_session(rfm95_handle_t *handle, const uint8_t device_address[4],
+                                 const uint8_t network_session_key[16], const uint8_t application_session_key[16]);
+
+bool rfm95_remove_multicast_session(rfm95_handle_t *handle, const uint8_t device_address[4]);
+
+uint32_t rfm95_time_on_air_us(uint8_t spreading_factor, uint32_t bandwidth, uint8_t coding_rate,
+                              uint16_t preamble_length, size_t payload_length, bool implicit_header, bool crc);
+
+uint32_t rfm95_get_channel_available_ticks(rfm95_handle_t *handle, uint8_t channel_index);
+
+uint32_t rfm95_get_next_tx_ticks(rfm95_handle_t *handle);
+
+size_t rfm95_get_max_payload_length(rfm95_handle_t *handle);
+
+bool rfm95_acquire_beacon(rfm95_handle_t *handle);
+
+bool rfm95_receive_class_b(rfm95_handle_t *handle);
+
 bool rfm95_send_receive_cycle(rfm95_handle_t *handle, const uint8_t *send_data, size_t send_data_length);
 
+bool rfm95_send_confirmed_receive_cycle(rfm95_handle_t *handle, const uint8_t *send_data, size_t send_data_length);
+
+bool rfm95_send_encoded_receive_cycle(rfm95_handle_t *handle, rfm95_codec_t *codec, const int32_t *values);
+
+bool rfm95_decode_payload(rfm95_codec_t *codec, const uint8_t *payload, size_t payload_length, int32_t *values);
+
+bool rfm95_process_downlinks(rfm95_handle_t *handle);
+
+bool rfm95_p2p_start(rfm95_handle_t *handle, const rfm95_p2p_config_t *config);
+
+bool rfm95_p2p_start_receive(rfm95_handle_t *handle);
+
+bool rfm95_p2p_send(rfm95_handle_t *handle, const uint8_t *payload, size_t payload_length);
+
+bool rfm95_p2p_receive(rfm95_handle_t *handle, rfm95_rx_packet_t *packet);
+
+uint32_t rfm95_wake_on_radio_interval_ms(const rfm95_p2p_config_t *config, uint32_t max_latency_ms,
+                                         uint16_t rx_duty_permille);
+
+uint16_t rfm95_wake_on_radio_preamble_length(const rfm95_p2p_config_t *config, uint32_t sniff_interval_ms);
+
+bool rfm95_p2p_wake_on_radio(rfm95_handle_t *handle, uint32_t sniff_interval_ms, uint32_t timeout_ms);
+
+bool rfm95_p2p_stop(rfm95_handle_t *handle);
+
+bool rfm95_fsk_start(rfm95_handle_t *handle, const rfm95_fsk_config_t *config);
+
+bool rfm95_fsk_send(rfm95_handle_t *handle, const uint8_t *data, size_t data_length);
+
+bool rfm95_fsk_receive(rfm95_handle_t *handle, uint8_t *buffer, size_t buffer_size, size_t *length,
+                       uint32_t timeout_ms);
+
+bool rfm95_fsk_stop(rfm95_handle_t *handle);
+
+bool rfm95_enqueue_uplink(rfm95_handle_t *handle, const uint8_t *record, size_t record_length, uint32_t deadline_ticks);
+
+bool rfm95_process_uplink_queue(rfm95_handle_t *handle);
+
+bool rfm95_flush_uplink_queue(rfm95_handle_t *handle);
+
+bool rfm95_setup_fragmentation_session(rfm95_handle_t *handle, uint8_t fragment_index, uint8_t *buffer,
+                                       uint16_t fragment_count, uint8_t fragment_size);
+
+bool rfm95_send_fragmented(rfm95_handle_t *handle, const uint8_t *data, size_t data_length, uint8_t fragment_size,
+                           uint16_t redundancy, uint16_t *sent_count);
+
 void rfm95_on_interrupt(rfm95_handle_t *handle, rfm95_interrupt_t interrupt);
+
+void rfm95_bus_init(rfm95_bus_t *bus, SPI_HandleTypeDef *spi_handle);
+
+bool rfm95_bus_add(rfm95_bus_t *bus, rfm95_handle_t *handle);
+
+void rfm95_bus_on_interrupt(rfm95_bus_t *bus, uint16_t gpio_pin);
@@ -0,0 +1,348 @@
+#include "mock_hal.h"
+
+#include <string.h>
+
+#define MOCK_REGISTER_FIFO 0x00
+#define MOCK_REGISTER_OP_MODE 0x01
+#define MOCK_REGISTER_FIFO_ADDR_PTR 0x0D
+#define MOCK_REGISTER_FIFO_TX_BASE_ADDR 0x0E
+#define MOCK_REGISTER_FIFO_RX_BASE_ADDR 0x0F
+#define MOCK_REGISTER_FIFO_RX_CURRENT_ADDR 0x10
+#define MOCK_REGISTER_IRQ_FLAGS 0x12
+#define MOCK_REGISTER_FIFO_RX_BYTES_NB 0x13
+#define MOCK_REGISTER_PACKET_SNR 0x19
+#define MOCK_REGISTER_PACKET_RSSI 0x1A
+#define MOCK_REGISTER_MODEM_CONFIG_1 0x1D
+#define MOCK_REGISTER_MODEM_CONFIG_2 0x1E
+#define MOCK_REGISTER_PREAMBLE_MSB 0x20
+#define MOCK_REGISTER_PREAMBLE_LSB 0x21
+#define MOCK_REGISTER_PAYLOAD_LENGTH 0x22
+#define MOCK_REGISTER_MODEM_CONFIG_3 0x26
+#define MOCK_REGISTER_DIO_MAPPING_1 0x40
+#define MOCK_REGISTER_VERSION 0x42
+
+#define MOCK_OP_MODE_LORA 0x80
+#define MOCK_OP_MODE_STANDBY 0x01
+#define MOCK_OP_MODE_TX 0x03
+#define MOCK_OP_MODE_RX_CONTINUOUS 0x05
+#define MOCK_OP_MODE_RX_SINGLE 0x06
+
+#define MOCK_IRQ_FLAGS_TX_DONE 0x08
+#define MOCK_IRQ_FLAGS_VALID_HEADER 0x10
+#define MOCK_IRQ_FLAGS_RX_DONE 0x40
+
+// Time starts above zero, the driver takes an interrupt time of zero as no interrupt.
+#define MOCK_HAL_START_TICKS 1000
+
+static uint32_t now_ticks = MOCK_HAL_START_TICKS;
+static mock_radio_t *radios = NULL;
+static bool dispatching = false;
+
+static const uint32_t bandwidths[] = { 7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000, 500000 };
+
+void mock_hal_reset(void)
+{
+	now_ticks = MOCK_HAL_START_TICKS;
+	radios = NULL;
+	dispatching = false;
+}
+
+void mock_radio_init(mock_radio_t *radio, SPI_HandleTypeDef *spi_handle)
+{
+	memset(radio, 0, sizeof(*radio));
+	radio->address = -1;
+	radio->registers[MOCK_REGISTER_VERSION] = 0x12;
+
+	spi_handle->Init.Mode = SPI_MODE_MASTER;
+	spi_handle->Init.Direction = SPI_DIRECTION_2LINES;
+	spi_handle->Init.DataSize = SPI_DATASIZE_8BIT;
+	spi_handle->Init.CLKPolarity = SPI_POLARITY_LOW;
+	spi_handle->Init.CLKPhase = SPI_PHASE_1EDGE;
+	spi_handle->radio = radio;
+
+	radio->next = radios;
+	radios = radio;
+}
+
+uint32_t mock_radio_time_on_air_us(const mock_radio_t *radio, uint8_t length)
+{
+	const uint8_t *registers = radio->registers;
+
+	uint8_t bandwidth_index = registers[MOCK_REGISTER_MODEM_CONFIG_1] >> 4;
+	uint32_t bandwidth = bandwidths[bandwidth_index < 10 ? bandwidth_index : 7];
+	int32_t coding_rate = (registers[MOCK_REGISTER_MODEM_CONFIG_1] >> 1) & 0x07;
+	int32_t implicit_header = registers[MOCK_REGISTER_MODEM_CONFIG_1] & 0x01;
+	int32_t spreading_factor = registers[MOCK_REGISTER_MODEM_CONFIG_2] >> 4;
+	int32_t crc = (registers[MOCK_REGISTER_MODEM_CONFIG_2] >> 2) & 0x01;
+	int32_t low_data_rate_optimize = (registers[MOCK_REGISTER_MODEM_CONFIG_3] >> 3) & 0x01;
+	uint32_t preamble_length = (registers[MOCK_REGISTER_PREAMBLE_MSB] << 8) | registers[MOCK_REGISTER_PREAMBLE_LSB];
+
+	// SX1276 datasheet 4.1.1.7, the preamble takes 4.25 symbols more than programmed.
+	int32_t numerator = 8 * length - 4 * spreading_factor + 28 + 16 * crc - 20 * implicit_header;
+	int32_t denominator = 4 * (spreading_factor - 2 * low_data_rate_optimize);
+	int32_t blocks = numerator > 0 ? (numerator + denominator - 1) / denominator : 0;
+	uint32_t payload_symbols = 8 + blocks * (coding_rate + 4);
+
+	uint64_t quarter_symbols = 4 * (uint64_t)preamble_length + 17 + 4 * (uint64_t)payload_symbols;
+	return (uint32_t)((quarter_symbols << spreading_factor) * 1000000 / (4 * (uint64_t)bandwidth));
+}
+
+static void raise_dio(mock_radio_t *radio, uint8_t dio)
+{
+	if (radio->on_dio != NULL) {
+		radio->on_dio(radio, dio);
+	}
+}
+
+static void complete_transmission(mock_radio_t *radio)
+{
+	radio->transmitting = false;
+	radio->tx_count++;
+	radio->registers[MOCK_REGISTER_OP_MODE] = (radio->registers[MOCK_REGISTER_OP_MODE] & 0xf8) | MOCK_OP_MODE_STANDBY;
+	radio->registers[MOCK_REGISTER_IRQ_FLAGS] |= MOCK_IRQ_FLAGS_TX_DONE;
+
+	if (radio->on_transmit != NULL) {
+		radio->on_transmit(radio, radio->tx_payload, radio->tx_length);
+	}
+
+	// DIO0 signals TxDone with mapping 01.
+	if ((radio->registers[MOCK_REGISTER_DIO_MAPPING_1] >> 6) == 0x01) {
+		raise_dio(radio, 0);
+	}
+}
+
+static void advance(uint32_t ticks_target)
+{
+	// Interrupts raised by a callback are only dispatched once it returned, as nested interrupts of one radio would
+	// be on hardware.
+	if (dispatching) {
+		if ((int32_t)(ticks_target - now_ticks) > 0) now_ticks = ticks_target;
+		return;
+	}
+
+	dispatching = true;
+
+	while (true) {
+
+		mock_radio_t *next = NULL;
+		for (mock_radio_t *radio = radios; radio != NULL; radio = radio->next) {
+			if (radio->mode_ready_pending) {
+				radio->mode_ready_pending = false;
+				raise_dio(radio, 5);
+			}
+			if (radio->transmitting && (int32_t)(radio->tx_end_ticks - ticks_target) <= 0 &&
+			    (next == NULL || (int32_t)(radio->tx_end_ticks - next->tx_end_ticks) < 0)) {
+				next = radio;
+			}
+		}
+
+		if (next == NULL) {
+			break;
+		}
+
+		if ((int32_t)(next->tx_end_ticks - now_ticks) > 0) now_ticks = next->tx_end_ticks;
+		complete_transmission(next);
+	}
+
+	if ((int32_t)(ticks_target - now_ticks) > 0) now_ticks = ticks_target;
+
+	dispatching = false;
+}
+
+bool mock_radio_receive(mock_radio_t *radio, const uint8_t *payload, uint8_t length, int8_t snr)
+{
+	uint8_t *registers = radio->registers;
+	uint8_t op_mode = registers[MOCK_REGISTER_OP_MODE];
+	uint8_t mode = op_mode & 0x07;
+
+	if ((op_mode & MOCK_OP_MODE_LORA) == 0 || (mode != MOCK_OP_MODE_RX_CONTINUOUS && mode != MOCK_OP_MODE_RX_SINGLE)) {
+		radio->rx_missed_count++;
+		return false;
+	}
+
+	uint8_t base = registers[MOCK_REGISTER_FIFO_RX_BASE_ADDR];
+	for (uint16_t i = 0; i < length; i++) {
+		radio->fifo[(uint8_t)(base + i)] = payload[i];
+	}
+
+	registers[MOCK_REGISTER_FIFO_RX_CURRENT_ADDR] = base;
+	registers[MOCK_REGISTER_FIFO_RX_BYTES_NB] = length;
+	registers[MOCK_REGISTER_PACKET_SNR] = (uint8_t)(snr * 4);
+	registers[MOCK_REGISTER_PACKET_RSSI] = 80;
+	registers[MOCK_REGISTER_IRQ_FLAGS] |= MOCK_IRQ_FLAGS_RX_DONE | MOCK_IRQ_FLAGS_VALID_HEADER;
+	radio->rx_count++;
+
+	if (mode == MOCK_OP_MODE_RX_SINGLE) {
+		registers[MOCK_REGISTER_OP_MODE] = (op_mode & 0xf8) | MOCK_OP_MODE_STANDBY;
+	}
+
+	// DIO0 signals RxDone with mapping 00.
+	if ((registers[MOCK_REGISTER_DIO_MAPPING_1] >> 6) == 0x00) {
+		raise_dio(radio, 0);
+	}
+
+	return true;
+}
+
+static void write_op_mode(mock_radio_t *radio, uint8_t value)
+{
+	uint8_t *registers = radio->registers;
+
+	registers[MOCK_REGISTER_OP_MODE] = value;
+
+	// Leaving transmit mode aborts the transmission.
+	if ((value & 0x07) != MOCK_OP_MODE_TX) {
+		radio->transmitting = false;
+	}
+
+	if ((value & 0x07) != 0) {
+		radio->mode_ready_pending = true;
+	}
+
+	if ((value & MOCK_OP_MODE_LORA) && (value & 0x07) == MOCK_OP_MODE_TX && !radio->transmitting) {
+		uint8_t length = registers[MOCK_REGISTER_PAYLOAD_LENGTH];
+		uint8_t base = registers[MOCK_REGISTER_FIFO_TX_BASE_ADDR];
+		for (uint16_t i = 0; i < length; i++) {
+			radio->tx_payload[i] = radio->fifo[(uint8_t)(base + i)];
+		}
+
+		radio->tx_length = length;
+		radio->tx_end_ticks = now_ticks + mock_radio_time_on_air_us(radio, length);
+		radio->transmitting = true;
+	}
+}
+
+static void write_byte(mock_radio_t *radio, uint8_t value)
+{
+	uint8_t address = (uint8_t)radio->address & 0x7f;
+
+	if (address == MOCK_REGISTER_FIFO) {
+		radio->fifo[radio->registers[MOCK_REGISTER_FIFO_ADDR_PTR]++] = value;
+		return;
+	}
+
+	if (address == MOCK_REGISTER_OP_MODE) {
+		write_op_mode(radio, value);
+	} else if (address == MOCK_REGISTER_IRQ_FLAGS) {
+		// Flags are cleared by writing ones.
+		radio->registers[address] &= ~value;
+	} else if (address != MOCK_REGISTER_VERSION) {
+		radio->registers[address] = value;
+	}
+
+	// Bursts continue at the next register.
+	radio->address = (radio->address + 1) & 0xff;
+}
+
+static uint8_t read_byte(mock_radio_t *radio)
+{
+	uint8_t address = (uint8_t)radio->address & 0x7f;
+
+	if (address == MOCK_REGISTER_FIFO) {
+		return radio->fifo[radio->registers[MOCK_REGISTER_FIFO_ADDR_PTR]++];
+	}
+
+	radio->address = (radio->address + 1) & 0xff;
+	return radio->registers[address];
+}
+
+uint32_t mock_hal_now(void)
+{
+	return now_ticks;
+}
+
+uint32_t mock_hal_get_tick(void)
+{
+	advance(now_ticks + MOCK_HAL_POLL_TICKS);
+	return now_ticks;
+}
+
+void mock_hal_sleep_until(uint32_t ticks_target)
+{
+	if ((int32_t)(ticks_target - now_ticks) > 0) {
+		advance(ticks_target);
+	}
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state)
+{
+	if (port == NULL) {
+		return;
+	}
+
+	if (state == GPIO_PIN_SET) {
+		port->ODR |= pin;
+	} else {
+		port->ODR &= ~(uint32_t)pin;
+	}
+}
+
+void HAL_Delay(uint32_t delay)
+{
+	advance(now_ticks + delay * (MOCK_HAL_TICK_FREQUENCY / 1000));
+}
+
+uint32_t HAL_GetTick(void)
+{
+	return now_ticks / (MOCK_HAL_TICK_FREQUENCY / 1000);
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *spi_handle, uint8_t *data, uint16_t size, uint32_t timeout)
+{
+	(void)timeout;
+
+	mock_radio_t *radio = spi_handle->radio;
+	now_ticks += size * MOCK_HAL_SPI_BYTE_TICKS;
+
+	// The driver sends the address on its own, followed by a burst, or together with a single register value. A
+	// transaction ends with the burst.
+	uint16_t index = 0;
+	bool burst = radio->address >= 0;
+	if (!burst) {
+		radio->address = data[index++];
+	}
+
+	for (; index < size; index++) {
+		write_byte(radio, data[index]);
+	}
+
+	if (burst || size > 1) {
+		radio->address = -1;
+	}
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *spi_handle, uint8_t *data, uint16_t size, uint32_t timeout)
+{
+	(void)timeout;
+
+	mock_radio_t *radio = spi_handle->radio;
+	now_ticks += size * MOCK_HAL_SPI_BYTE_TICKS;
+
+	for (uint16_t index = 0; index < size; index++) {
+		data[index] = read_byte(radio);
+	}
+
+	radio->address = -1;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *spi_handle)
+{
+	spi_handle->radio->address = -1;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_DeInit(SPI_HandleTypeDef *spi_handle)
+{
+	(void)spi_handle;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Init(SPI_HandleTypeDef *spi_handle)
+{
+	(void)spi_handle;
+	return HAL_OK;
+}
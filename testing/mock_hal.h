@@ -0,0 +1,154 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Host replacement of the STM32 HAL used when building with TESTING. The SPI functions talk to an emulated SX1276 in
+ * LoRa mode, enough of it to run the driver against: registers, FIFO, transmission with the time on air of the
+ * configured modulation, and reception of packets handed in by the test. Time is virtual and only advances through
+ * mock_hal_get_tick, mock_hal_sleep_until, HAL_Delay and SPI transfers.
+ */
+
+typedef enum {
+	HAL_OK = 0x00,
+	HAL_ERROR = 0x01,
+	HAL_BUSY = 0x02,
+	HAL_TIMEOUT = 0x03
+} HAL_StatusTypeDef;
+
+typedef enum {
+	GPIO_PIN_RESET = 0,
+	GPIO_PIN_SET
+} GPIO_PinState;
+
+typedef struct {
+	uint32_t ODR;
+} GPIO_TypeDef;
+
+#define SPI_MODE_MASTER 0x00000104u
+#define SPI_DIRECTION_2LINES 0x00000000u
+#define SPI_DATASIZE_8BIT 0x00000700u
+#define SPI_POLARITY_LOW 0x00000000u
+#define SPI_PHASE_1EDGE 0x00000000u
+
+typedef struct {
+	uint32_t Mode;
+	uint32_t Direction;
+	uint32_t DataSize;
+	uint32_t CLKPolarity;
+	uint32_t CLKPhase;
+} SPI_InitTypeDef;
+
+struct mock_radio;
+
+typedef struct {
+
+	SPI_InitTypeDef Init;
+
+	/**
+	 * The emulated radio on the other end of the bus.
+	 */
+	struct mock_radio *radio;
+
+} SPI_HandleTypeDef;
+
+/**
+ * Virtual time in microseconds, the tests use it as precision tick at 1MHz.
+ */
+#define MOCK_HAL_TICK_FREQUENCY 1000000
+
+/**
+ * Ticks a busy waiting driver loop advances the time by with each poll.
+ */
+#define MOCK_HAL_POLL_TICKS 10
+
+/**
+ * Ticks an SPI transfer takes per byte, 8MHz SPI clock.
+ */
+#define MOCK_HAL_SPI_BYTE_TICKS 1
+
+/**
+ * DIO line of a mock radio was raised, the test forwards it to rfm95_on_interrupt.
+ */
+typedef void (*mock_radio_on_dio)(struct mock_radio *radio, uint8_t dio);
+
+/**
+ * Mock radio finished a transmission, the test decides who receives it.
+ */
+typedef void (*mock_radio_on_transmit)(struct mock_radio *radio, const uint8_t *payload, uint8_t length);
+
+typedef struct mock_radio {
+
+	/**
+	 * Register file and FIFO of the emulated SX1276.
+	 */
+	uint8_t registers[0x80];
+	uint8_t fifo[256];
+
+	/**
+	 * Address of the ongoing SPI transaction, -1 while waiting for the address byte.
+	 */
+	int16_t address;
+
+	/**
+	 * Packet on air and the time its transmission ends, valid while transmitting.
+	 */
+	uint8_t tx_payload[256];
+	uint8_t tx_length;
+	uint32_t tx_end_ticks;
+	bool transmitting;
+
+	/**
+	 * Set by a mode change until the ModeReady interrupt on DIO5 was raised.
+	 */
+	bool mode_ready_pending;
+
+	/**
+	 * Callbacks of the test, the context lets them find the driver handle.
+	 */
+	mock_radio_on_dio on_dio;
+	mock_radio_on_transmit on_transmit;
+	void *context;
+
+	/**
+	 * Number of completed transmissions and of packets received or lost as the radio was not receiving.
+	 */
+	uint32_t tx_count;
+	uint32_t rx_count;
+	uint32_t rx_missed_count;
+
+	struct mock_radio *next;
+
+} mock_radio_t;
+
+void mock_hal_reset(void);
+
+void mock_radio_init(mock_radio_t *radio, SPI_HandleTypeDef *spi_handle);
+
+uint32_t mock_radio_time_on_air_us(const mock_radio_t *radio, uint8_t length);
+
+bool mock_radio_receive(mock_radio_t *radio, const uint8_t *payload, uint8_t length, int8_t snr);
+
+uint32_t mock_hal_now(void);
+
+uint32_t mock_hal_get_tick(void);
+
+void mock_hal_sleep_until(uint32_t ticks_target);
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state);
+
+void HAL_Delay(uint32_t delay);
+
+uint32_t HAL_GetTick(void);
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *spi_handle, uint8_t *data, uint16_t size, uint32_t timeout);
+
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *spi_handle, uint8_t *data, uint16_t size, uint32_t timeout);
+
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *spi_handle);
+
+HAL_StatusTypeDef HAL_SPI_DeInit(SPI_HandleTypeDef *spi_handle);
+
+HAL_StatusTypeDef HAL_SPI_Init(SPI_HandleTypeDef *spi_handle);
@@ -0,0 +1,255 @@
+#include "rfm95.h"
+#include "lib/ideetron/Encrypt_V31.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Loss tolerance of the fragmented data block transport versus its overhead. A block is sent once per redundancy
+ * through rfm95_send_fragmented on an emulated radio. The test stands in for the network: it drops each frame with a
+ * given probability and passes the remaining fragments to a second, Class C handle as down-links, which reassembles
+ * them. Losses are drawn per fragment number, so more redundancy only ever adds fragments to those received.
+ */
+
+#define FRAGMENT_SIZE 24
+#define FRAGMENT_COUNT 20
+#define BLOCK_LENGTH (FRAGMENT_SIZE * FRAGMENT_COUNT)
+#define TRIAL_COUNT 100
+#define REDUNDANCY_MAX 20
+
+static const uint16_t redundancies[] = { 0, 2, 4, 10, REDUNDANCY_MAX };
+static const uint8_t loss_percentages[] = { 0, 5, 10, 20, 30 };
+
+#define REDUNDANCY_COUNT (sizeof(redundancies) / sizeof(redundancies[0]))
+#define LOSS_COUNT (sizeof(loss_percentages) / sizeof(loss_percentages[0]))
+
+static uint8_t device_address[4] = { 0x26, 0x01, 0x1b, 0x3c };
+static uint8_t network_session_key[16] = { 0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+                                           0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+static uint8_t application_session_key[16] = { 0x3c, 0x4f, 0xcf, 0x09, 0x88, 0x15, 0xf7, 0xab,
+                                               0xa6, 0xd2, 0xae, 0x28, 0x16, 0x15, 0x7e, 0x2b };
+
+static SPI_HandleTypeDef sender_spi, receiver_spi;
+static mock_radio_t sender_radio, receiver_radio;
+static rfm95_handle_t sender, receiver;
+
+// Frame payloads of the up-links, decrypted as the network would.
+static uint8_t fragments[FRAGMENT_COUNT + REDUNDANCY_MAX][3 + FRAGMENT_SIZE];
+static uint16_t fragment_total;
+
+static uint8_t block[BLOCK_LENGTH];
+static uint8_t reassembled[BLOCK_LENGTH];
+static bool block_complete;
+static uint16_t downlink_frame_count;
+
+static int failures;
+
+static void check(bool condition, const char *message)
+{
+	if (!condition) {
+		printf("FAIL: %s\n", message);
+		failures++;
+	}
+}
+
+static uint8_t random_int(uint8_t max)
+{
+	return (uint8_t)(rand() % (max + 1));
+}
+
+static void on_dio(mock_radio_t *radio, uint8_t dio)
+{
+	rfm95_interrupt_t interrupt = dio == 0 ? RFM95_INTERRUPT_DIO0
+	                            : dio == 1 ? RFM95_INTERRUPT_DIO1
+	                                       : RFM95_INTERRUPT_DIO5;
+	rfm95_on_interrupt((rfm95_handle_t *)radio->context, interrupt);
+}
+
+static void on_uplink(mock_radio_t *radio, const uint8_t *payload, uint8_t length)
+{
+	(void)radio;
+
+	// MAC header, device address, frame control, frame counter, options, port, payload and MIC.
+	uint8_t frame_options_length = payload[5] & 0x0f;
+	uint16_t frame_count = payload[6] | (payload[7] << 8);
+	uint8_t port = payload[8 + frame_options_length];
+	uint8_t payload_start = 9 + frame_options_length;
+	uint8_t payload_length = length - 4 - payload_start;
+
+	if (port != RFM95_FRAGMENTATION_PORT || payload_length != 3 + FRAGMENT_SIZE ||
+	    fragment_total == FRAGMENT_COUNT + REDUNDANCY_MAX) {
+		return;
+	}
+
+	memcpy(fragments[fragment_total], &payload[payload_start], payload_length);
+	Encrypt_Payload(fragments[fragment_total], payload_length, frame_count, 0, application_session_key,
+	                device_address);
+	fragment_total++;
+}
+
+static void on_fragmented_block(const uint8_t *data, size_t data_length)
+{
+	block_complete = data_length == BLOCK_LENGTH && memcmp(data, block, BLOCK_LENGTH) == 0;
+}
+
+static void send_downlink(const uint8_t *frame_payload, uint8_t frame_payload_length)
+{
+	uint8_t payload[RFM95_PHY_PAYLOAD_MAX_LENGTH];
+	uint8_t length = 0;
+
+	downlink_frame_count++;
+
+	payload[length++] = 0x60; // Unconfirmed data down
+	payload[length++] = device_address[3];
+	payload[length++] = device_address[2];
+	payload[length++] = device_address[1];
+	payload[length++] = device_address[0];
+	payload[length++] = 0x00;
+	payload[length++] = (uint8_t)downlink_frame_count;
+	payload[length++] = (uint8_t)(downlink_frame_count >> 8);
+	payload[length++] = RFM95_FRAGMENTATION_PORT;
+
+	memcpy(&payload[length], frame_payload, frame_payload_length);
+	Encrypt_Payload(&payload[length], frame_payload_length, downlink_frame_count, 1, application_session_key,
+	                device_address);
+	length += frame_payload_length;
+
+	Calculate_MIC(payload, &payload[length], length, downlink_frame_count, 1, network_session_key, device_address);
+	length += 4;
+
+	mock_radio_receive(&receiver_radio, payload, length, 5);
+	rfm95_process_downlinks(&receiver);
+}
+
+static bool fragment_lost(uint32_t trial, uint16_t n, uint8_t loss_percentage)
+{
+	// Same decision for a fragment number in every run, independent of how many fragments are sent.
+	uint32_t x = trial * 0x9e3779b9u ^ n * 0x85ebca6bu ^ loss_percentage * 0xc2b2ae35u;
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+
+	return x % 100 < loss_percentage;
+}
+
+static void init_handle(rfm95_handle_t *handle, SPI_HandleTypeDef *spi_handle, mock_radio_t *radio,
+                        rfm95_receive_mode_t receive_mode)
+{
+	memset(handle, 0, sizeof(*handle));
+	mock_radio_init(radio, spi_handle);
+	radio->on_dio = on_dio;
+	radio->context = handle;
+
+	handle->spi_handle = spi_handle;
+	memcpy(handle->device_address, device_address, sizeof(device_address));
+	memcpy(handle->network_session_key, network_session_key, sizeof(network_session_key));
+	memcpy(handle->application_session_key, application_session_key, sizeof(application_session_key));
+	handle->precision_tick_frequency = MOCK_HAL_TICK_FREQUENCY;
+	handle->receive_mode = receive_mode;
+	handle->get_precision_tick = mock_hal_get_tick;
+	handle->precision_sleep_until = mock_hal_sleep_until;
+	handle->random_int = random_int;
+}
+
+int main(void)
+{
+	srand(1);
+	for (size_t i = 0; i < BLOCK_LENGTH; i++) {
+		block[i] = (uint8_t)rand();
+	}
+
+	uint32_t success_counts[REDUNDANCY_COUNT][LOSS_COUNT] = { 0 };
+
+	for (size_t r = 0; r < REDUNDANCY_COUNT; r++) {
+
+		mock_hal_reset();
+
+		init_handle(&sender, &sender_spi, &sender_radio, RFM95_RECEIVE_MODE_NONE);
+		sender_radio.on_transmit = on_uplink;
+		check(rfm95_init(&sender), "sender init");
+
+		init_handle(&receiver, &receiver_spi, &receiver_radio, RFM95_RECEIVE_MODE_CLASS_C);
+		receiver.on_fragmented_block = on_fragmented_block;
+		check(rfm95_init(&receiver), "receiver init");
+		check(rfm95_process_downlinks(&receiver), "receiver starts continuous reception");
+		downlink_frame_count = 0;
+
+		// The duty cycle soon allows no channel, the application waits for it and continues the block.
+		fragment_total = 0;
+		uint16_t sent_count = 0;
+		while (!rfm95_send_fragmented(&sender, block, BLOCK_LENGTH, FRAGMENT_SIZE, redundancies[r], &sent_count)) {
+			if (!sender.duty_cycle_blocked) {
+				check(false, "send block failed other than on the duty cycle");
+				break;
+			}
+			mock_hal_sleep_until(rfm95_get_next_tx_ticks(&sender));
+		}
+		check(fragment_total == FRAGMENT_COUNT + redundancies[r], "every fragment sent in its own up-link");
+
+		for (size_t l = 0; l < LOSS_COUNT; l++) {
+			for (uint32_t trial = 0; trial < TRIAL_COUNT; trial++) {
+
+				memset(reassembled, 0, sizeof(reassembled));
+				block_complete = false;
+				check(rfm95_setup_fragmentation_session(&receiver, 0, reassembled, FRAGMENT_COUNT, FRAGMENT_SIZE),
+				      "setup session");
+
+				uint16_t lost = 0;
+				for (uint16_t i = 0; i < fragment_total; i++) {
+					uint16_t n = fragments[i][1] | (fragments[i][2] << 8);
+					if (fragment_lost(trial, n, loss_percentages[l])) {
+						lost++;
+						continue;
+					}
+					send_downlink(fragments[i], 3 + FRAGMENT_SIZE);
+				}
+
+				if (block_complete) {
+					success_counts[r][l]++;
+				}
+
+				// Without losses the block always arrives, without redundancy only then.
+				if (lost == 0) {
+					check(block_complete, "block complete without losses");
+				}
+				if (redundancies[r] == 0 && lost != 0) {
+					check(!block_complete, "block complete despite losses without redundancy");
+				}
+
+				// Fewer fragments than the block has can never be enough.
+				if (fragment_total - lost < FRAGMENT_COUNT) {
+					check(!block_complete, "block complete from too few fragments");
+				}
+			}
+		}
+	}
+
+	printf("Reassembled blocks of %d fragments out of %d trials\n", FRAGMENT_COUNT, TRIAL_COUNT);
+	printf("overhead  ");
+	for (size_t l = 0; l < LOSS_COUNT; l++) {
+		printf("  %2u%% loss", loss_percentages[l]);
+	}
+	printf("\n");
+
+	for (size_t r = 0; r < REDUNDANCY_COUNT; r++) {
+		printf("%7u%%  ", redundancies[r] * 100 / FRAGMENT_COUNT);
+		for (size_t l = 0; l < LOSS_COUNT; l++) {
+			printf("  %7.1f%%", success_counts[r][l] * 100.0 / TRIAL_COUNT);
+		}
+		printf("\n");
+
+		// More redundancy never hurts, as it only adds received fragments.
+		for (size_t l = 0; r > 0 && l < LOSS_COUNT; l++) {
+			check(success_counts[r][l] >= success_counts[r - 1][l], "success rate drops with more redundancy");
+		}
+	}
+
+	// 50% overhead recovers nearly every block at 10% loss, 100% overhead at 20%.
+	check(success_counts[3][2] >= TRIAL_COUNT * 95 / 100, "50% overhead at 10% loss");
+	check(success_counts[4][3] >= TRIAL_COUNT * 98 / 100, "100% overhead at 20% loss");
+
+	return failures == 0 ? 0 : 1;
+}